@@ -3,13 +3,20 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include "devices/iosched.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Data is moved by bus-master DMA if the controller is a PCI IDE
+   controller that supports it, such as the PIIX that QEMU
+   emulates, and by programmed I/O (PIO) otherwise. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +39,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +55,38 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA with retries. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA with retries. */
+
+/* Bus-master IDE register offsets, relative to a channel's
+   bus-master base port.  See [SFF-8038i]. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* PRD table physical address. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* 1=Transfer to memory, 0=from memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_IRQ 0x04         /* Interrupt (write 1 to clear). */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+
+/* A physical region descriptor, one entry in the table that
+   tells the bus master where to move data.  A region must not
+   cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* If false, always use PIO, even if DMA is available.
+   Controlled by kernel command-line option "-nodma". */
+bool disk_dma = true;
 
 /* An ATA device. */
 struct disk 
@@ -70,11 +110,18 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    struct lock lock;           /* Protects `queue' and `busy'. */
+    struct iosched_queue queue; /* Requests waiting for the controller. */
+    bool busy;                  /* True while a thread is dispatching
+                                   requests to the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus-master base port, 0 for PIO only. */
+    struct prd *prdt;           /* PRD table, if bm_base != 0. */
+    uint64_t xfer_cycles;       /* CPU cycles spent moving data. */
+
     struct disk devices[2];     /* The devices on this channel. */
   };
 
@@ -86,8 +133,17 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void submit_request (struct disk_request *);
+static void transfer_multiple (struct disk *, disk_sector_t, size_t,
+                               uint8_t *, bool write);
+static void execute_request (struct channel *, struct disk_request *);
+static void execute_pio (struct channel *, struct disk_request *);
+static bool execute_dma (struct channel *, struct disk_request *);
+static void complete_request (struct channel *, struct disk_request *,
+                              struct disk_request *self);
+
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -98,10 +154,22 @@ static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static uint16_t find_bus_master (void);
+
+/* Reads the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) 
 {
+  uint16_t bm_base = disk_dma ? find_bus_master () : 0;
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -125,8 +193,19 @@ disk_init (void)
           NOT_REACHED ();
         }
       lock_init (&c->lock);
+      iosched_init (&c->queue);
+      c->busy = false;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = 0;
+      c->prdt = NULL;
+      c->xfer_cycles = 0;
+      if (bm_base != 0) 
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + 8 * chan_no;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -159,6 +238,8 @@ disk_init (void)
     }
 }
 
+static void print_channel_stats (const struct channel *);
+
 /* Prints disk statistics. */
 void
 disk_print_stats (void) 
@@ -176,9 +257,23 @@ disk_print_stats (void)
             printf ("%s: %lld reads, %lld writes\n",
                     d->name, d->read_cnt, d->write_cnt);
         }
+      print_channel_stats (&channels[chan_no]);
     }
 }
 
+/* Prints statistics for channel C. */
+static void
+print_channel_stats (const struct channel *c) 
+{
+  long long sectors = c->queue.sector_cnt;
+
+  iosched_print_stats (&c->queue, c->name);
+  if (sectors > 0)
+    printf ("%s: %s, %llu CPU cycles per MB transferred\n",
+            c->name, c->bm_base != 0 ? "bus-master DMA" : "PIO",
+            c->xfer_cycles * (1024 * 1024 / DISK_SECTOR_SIZE) / sectors);
+}
+
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
    slave, respectively--within the channel numbered CHAN_NO.
 
@@ -219,21 +314,13 @@ disk_size (struct disk *d)
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) 
 {
-  struct channel *c;
-  
+  struct disk_request r;
+
   ASSERT (d != NULL);
   ASSERT (buffer != NULL);
 
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  d->read_cnt++;
-  lock_release (&c->lock);
+  iosched_request_init (&r, d, sec_no, 1, buffer, false);
+  submit_request (&r);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -244,23 +331,321 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
-  struct channel *c;
-  
+  struct disk_request r;
+
+  ASSERT (d != NULL);
+  ASSERT (buffer != NULL);
+
+  iosched_request_init (&r, d, sec_no, 1, (void *) buffer, true);
+  submit_request (&r);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  Large transfers are split into requests of at most
+   IOSCHED_MAX_SECTORS sectors, each carried out by one command.
+   The requests may be carried out by whichever thread is
+   dispatching for the channel, so BUFFER must be a kernel
+   address, not a user one; a kernel-aligned BUFFER is filled by
+   DMA without any copying. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                    void *buffer) 
+{
+  transfer_multiple (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                     const void *buffer) 
+{
+  transfer_multiple (d, sec_no, cnt, (void *) buffer, true);
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER, in the direction given by WRITE. */
+static void
+transfer_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+                   uint8_t *buffer, bool write) 
+{
   ASSERT (d != NULL);
   ASSERT (buffer != NULL);
 
-  c = d->channel;
+  while (cnt > 0) 
+    {
+      size_t n = cnt < IOSCHED_MAX_SECTORS ? cnt : IOSCHED_MAX_SECTORS;
+      struct disk_request r;
+
+      iosched_request_init (&r, d, sec_no, n, buffer, write);
+      submit_request (&r);
+
+      sec_no += n;
+      cnt -= n;
+      buffer += n * DISK_SECTOR_SIZE;
+    }
+}
+
+/* Request dispatching.
+
+   There is no dedicated thread driving a channel.  Instead, a
+   thread that submits a request while the channel is idle
+   becomes the channel's dispatcher: it carries out requests, in
+   the order chosen by the I/O scheduler, until its own request
+   has completed.  It then hands the dispatcher role to the
+   submitter of the next request, if there is one, by waking it
+   up with its `dispatch' member set.  Requests submitted in the
+   meantime just queue up, which gives the scheduler something to
+   reorder and merge. */
+
+/* Queues R and waits for it to complete. */
+static void
+submit_request (struct disk_request *r) 
+{
+  struct channel *c = r->disk->channel;
+  struct disk_request *next;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
+  iosched_add (&c->queue, r);
+  if (c->busy) 
+    {
+      /* Another thread is dispatching.  Wait for it to carry
+         out R or to hand us the dispatcher role. */
+      lock_release (&c->lock);
+      sema_down (&r->done);
+      if (!r->dispatch)
+        return;
+      next = r;
+    }
+  else
+    {
+      c->busy = true;
+      next = iosched_next (&c->queue);
+      lock_release (&c->lock);
+    }
+
+  for (;;) 
+    {
+      execute_request (c, next);
+
+      lock_acquire (&c->lock);
+      complete_request (c, next, r);
+      next = iosched_next (&c->queue);
+      if (next == NULL)
+        {
+          c->busy = false;
+          lock_release (&c->lock);
+          break;
+        }
+      lock_release (&c->lock);
+
+      if (r->completed) 
+        {
+          /* Our own request is done, so let the submitter of the
+             next one carry on. */
+          next->dispatch = true;
+          sema_up (&next->done);
+          break;
+        }
+    }
+}
+
+/* Transfers the sectors for HEAD and the requests merged into
+   it with a single ATA command. */
+static void
+execute_request (struct channel *c, struct disk_request *head) 
+{
+  struct disk *d = head->disk;
+
+  if (c->bm_base == 0 || !execute_dma (c, head))
+    execute_pio (c, head);
+
+  if (head->write)
+    d->write_cnt += head->span;
+  else
+    d->read_cnt += head->span;
+}
+
+/* Transfers the sectors for HEAD and the requests merged into it
+   in PIO mode, one sector at a time through the data register. */
+static void
+execute_pio (struct channel *c, struct disk_request *head) 
+{
+  struct disk *d = head->disk;
+  struct list_elem *e = list_begin (&head->merged);
+  struct disk_request *r = head;
+
+  select_sector (d, head->sector, head->span);
+  issue_command (c, (head->write
+                     ? CMD_WRITE_SECTOR_RETRY
+                     : CMD_READ_SECTOR_RETRY));
+  for (;;) 
+    {
+      uint8_t *buffer = r->buffer;
+      size_t i;
+
+      for (i = 0; i < r->cnt; i++, buffer += DISK_SECTOR_SIZE) 
+        {
+          uint64_t start;
+
+          if (head->write) 
+            {
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, r->sector + i);
+              start = rdtsc ();
+              output_sector (c, buffer);
+              c->xfer_cycles += rdtsc () - start;
+              sema_down (&c->completion_wait);
+            }
+          else
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, r->sector + i);
+              start = rdtsc ();
+              input_sector (c, buffer);
+              c->xfer_cycles += rdtsc () - start;
+            }
+        }
+
+      if (e == list_end (&head->merged))
+        break;
+      r = list_entry (e, struct disk_request, elem);
+      e = list_next (e);
+    }
+}
+
+/* Appends the physical regions making up the SIZE bytes at
+   kernel virtual address BUFFER to C's PRD table, starting at
+   entry *IDX.  Returns false if BUFFER cannot be used for DMA or
+   the table is full. */
+static bool
+add_prd_regions (struct channel *c, size_t *idx, void *buffer, size_t size) 
+{
+  uint8_t *p = buffer;
+
+  if (!is_kernel_vaddr (p) || ((uintptr_t) p & 1) != 0)
+    return false;
+
+  while (size > 0) 
+    {
+      uintptr_t paddr = vtop (p);
+      size_t region = 0x10000 - (paddr & 0xffff);
+      if (region > size)
+        region = size;
+
+      /* Extend the previous region if this one continues it. */
+      if (*idx > 0) 
+        {
+          struct prd *prev = &c->prdt[*idx - 1];
+          size_t prev_size = prev->size != 0 ? prev->size : 0x10000;
+          if (prev->addr + prev_size == paddr
+              && (prev->addr >> 16) == (paddr >> 16)) 
+            {
+              prev->size = (prev_size + region) & 0xffff;
+              goto advance;
+            }
+        }
+
+      if (*idx >= PRD_CNT)
+        return false;
+      c->prdt[*idx].addr = paddr;
+      c->prdt[*idx].size = region & 0xffff;
+      c->prdt[*idx].flags = 0;
+      ++*idx;
+
+    advance:
+      p += region;
+      size -= region;
+    }
+  return true;
+}
+
+/* Transfers the sectors for HEAD and the requests merged into it
+   by bus-master DMA, scattering or gathering the data directly
+   to or from the requests' buffers.  Returns false, without
+   touching the disk, if some buffer is unsuitable for DMA. */
+static bool
+execute_dma (struct channel *c, struct disk_request *head) 
+{
+  struct disk *d = head->disk;
+  struct list_elem *e;
+  uint64_t start = rdtsc ();
+  size_t prd_cnt = 0;
+  uint8_t bm_status;
+
+  /* Build the PRD table. */
+  if (!add_prd_regions (c, &prd_cnt, head->buffer,
+                        head->cnt * DISK_SECTOR_SIZE))
+    return false;
+  for (e = list_begin (&head->merged); e != list_end (&head->merged);
+       e = list_next (e)) 
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, elem);
+      if (!add_prd_regions (c, &prd_cnt, r->buffer,
+                            r->cnt * DISK_SECTOR_SIZE))
+        return false;
+    }
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+  /* Program the bus master, then the disk, then start. */
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, head->write ? 0 : BM_CMD_READ);
+  outb (c->bm_base + BM_STATUS,
+        inb (c->bm_base + BM_STATUS) | BM_STA_IRQ | BM_STA_ERR);
+  select_sector (d, head->sector, head->span);
+  issue_command (c, head->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND,
+        inb (c->bm_base + BM_COMMAND) | BM_CMD_START);
+  c->xfer_cycles += rdtsc () - start;
+
   sema_down (&c->completion_wait);
-  d->write_cnt++;
-  lock_release (&c->lock);
+
+  /* Stop the bus master and check for errors. */
+  start = rdtsc ();
+  outb (c->bm_base + BM_COMMAND,
+        inb (c->bm_base + BM_COMMAND) & ~BM_CMD_START);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, bm_status | BM_STA_IRQ | BM_STA_ERR);
+  if ((bm_status & BM_STA_ERR) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk DMA %s failed, sector=%"PRDSNu,
+           d->name, head->write ? "write" : "read", head->sector);
+  c->xfer_cycles += rdtsc () - start;
+  return true;
 }
-
+
+/* Marks HEAD and the requests merged into it as completed and
+   wakes up their submitters, except for SELF, the request of the
+   running thread.  C's lock must be held. */
+static void
+complete_request (struct channel *c, struct disk_request *head,
+                  struct disk_request *self) 
+{
+  struct list_elem *e = list_begin (&head->merged);
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  while (e != list_end (&head->merged)) 
+    {
+      struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+      /* Once woken up, R's submitter may return and discard R,
+         so advance first. */
+      e = list_next (e);
+      iosched_complete (&c->queue, r);
+      if (r != self)
+        sema_up (&r->done);
+    }
+  iosched_complete (&c->queue, head);
+  if (head != self)
+    sema_up (&head->done);
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -374,7 +759,7 @@ identify_ata_device (struct disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -426,18 +811,19 @@ print_ata_string (char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and
+   sector count registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) 
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < d->capacity);
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= 256);
+  ASSERT (sec_no + cnt <= d->capacity);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == 256 ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -448,7 +834,7 @@ select_sector (struct disk *d, disk_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -546,6 +932,71 @@ select_device_wait (const struct disk *d)
   wait_until_idle (d);
 }
 
+/* PCI configuration space access, through configuration
+   mechanism #1.  See [PCI] 3.2.2.3.2. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Reads the 32-bit register at offset REG in the configuration
+   space of PCI function FUNC of device DEV on bus BUS. */
+static uint32_t
+pci_read_config (int bus, int dev, int func, int reg) 
+{
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (reg & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG in the
+   configuration space of PCI function FUNC of device DEV on bus
+   BUS. */
+static void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value) 
+{
+  outl (PCI_CONFIG_ADDR,
+        0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (reg & 0xfc));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, enables bus mastering on it, and returns its
+   bus-master base port.  Returns 0 if there is no such
+   controller. */
+static uint16_t
+find_bus_master (void) 
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++) 
+      {
+        uint32_t id = pci_read_config (0, dev, func, 0x00);
+        uint32_t class, bar4, command;
+
+        if ((id & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h (mass storage), subclass 01h (IDE),
+           programming interface bit 7 (bus master). */
+        class = pci_read_config (0, dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || (class & 0x8000) == 0)
+          continue;
+
+        /* BAR4 is the bus-master I/O space. */
+        bar4 = pci_read_config (0, dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        command = pci_read_config (0, dev, func, 0x04);
+        pci_write_config (0, dev, func, 0x04, command | 0x05);
+
+        printf ("ide: bus-master DMA at port %#"PRIx32"\n", bar4 & 0xfffc);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* ATA interrupt handler. */
 static void
 interrupt_handler (struct intr_frame *f) 
@@ -0,0 +1,296 @@
+#include "devices/iosched.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+
+/* Disk request scheduling.
+
+   Requests waiting for an ATA channel are kept in a queue.
+   Whenever the channel becomes free, the dispatcher in disk.c
+   asks for the next request to carry out.  Which request that is
+   depends on the policy:
+
+        - noop: requests are dispatched in arrival order.
+
+        - cscan: requests are dispatched in ascending sector
+          order, starting from the current head position.  Once
+          no request lies ahead of the head, it jumps back to the
+          lowest pending sector ("circular SCAN").
+
+        - deadline: like cscan, but each request is given an
+          expiration time when it is queued.  An expired request
+          is dispatched ahead of the elevator order, which bounds
+          how long any request can starve.
+
+   Under all policies a request for sectors directly before or
+   after a queued request of the same kind is merged into it, so
+   that both are carried out by a single ATA command. */
+
+/* Expiration times for the deadline policy, in timer ticks. */
+#define READ_EXPIRE (TIMER_FREQ / 4)
+#define WRITE_EXPIRE (TIMER_FREQ)
+
+enum iosched_policy iosched_policy = IOSCHED_CSCAN;
+
+/* Policy names, indexed by enum iosched_policy. */
+static const char *policy_names[] = {"noop", "cscan", "deadline"};
+
+static bool request_less (const struct list_elem *,
+                          const struct list_elem *, void *aux);
+static bool try_merge (struct iosched_queue *, struct disk_request *);
+
+/* Selects the policy named NAME.
+   Returns true if successful, false if NAME is unknown. */
+bool
+iosched_set_policy (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof policy_names / sizeof *policy_names; i++)
+    if (!strcmp (name, policy_names[i]))
+      {
+        iosched_policy = i;
+        return true;
+      }
+  return false;
+}
+
+/* Returns the name of the policy in use. */
+const char *
+iosched_policy_name (void)
+{
+  return policy_names[iosched_policy];
+}
+
+/* Initializes Q as an empty queue. */
+void
+iosched_init (struct iosched_queue *q)
+{
+  memset (q, 0, sizeof *q);
+  list_init (&q->requests);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR on disk D to or from BUFFER. */
+void
+iosched_request_init (struct disk_request *r, struct disk *d,
+                      disk_sector_t sector, size_t cnt, void *buffer,
+                      bool write)
+{
+  ASSERT (cnt > 0 && cnt <= IOSCHED_MAX_SECTORS);
+
+  r->disk = d;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  list_init (&r->merged);
+  r->span = cnt;
+  r->submit_time = r->deadline = 0;
+  r->completed = false;
+  r->dispatch = false;
+  sema_init (&r->done, 0);
+}
+
+/* Adds R to Q, merging it with a queued request if possible.
+   The caller must serialize access to Q. */
+void
+iosched_add (struct iosched_queue *q, struct disk_request *r)
+{
+  r->submit_time = timer_ticks ();
+  r->deadline = r->submit_time + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  if (q->first_tick == 0)
+    q->first_tick = r->submit_time;
+
+  if (try_merge (q, r))
+    {
+      q->merge_cnt++;
+      return;
+    }
+
+  if (iosched_policy == IOSCHED_NOOP)
+    list_push_back (&q->requests, &r->elem);
+  else
+    list_insert_ordered (&q->requests, &r->elem, request_less, NULL);
+  q->pending++;
+}
+
+/* Removes and returns the request that should be carried out
+   next, or a null pointer if Q is empty.
+   The caller must serialize access to Q. */
+struct disk_request *
+iosched_next (struct iosched_queue *q)
+{
+  struct disk_request *next = NULL;
+  struct list_elem *e;
+
+  if (list_empty (&q->requests))
+    return NULL;
+
+  if (iosched_policy == IOSCHED_DEADLINE)
+    {
+      /* Dispatch the most overdue request, if any. */
+      int64_t now = timer_ticks ();
+
+      for (e = list_begin (&q->requests); e != list_end (&q->requests);
+           e = list_next (e))
+        {
+          struct disk_request *r = list_entry (e, struct disk_request, elem);
+          if (r->deadline <= now
+              && (next == NULL || r->deadline < next->deadline))
+            next = r;
+        }
+      if (next != NULL)
+        q->expire_cnt++;
+    }
+
+  if (next == NULL && iosched_policy != IOSCHED_NOOP)
+    {
+      /* First request at or beyond the head, wrapping around to
+         the lowest one. */
+      for (e = list_begin (&q->requests); e != list_end (&q->requests);
+           e = list_next (e))
+        {
+          struct disk_request *r = list_entry (e, struct disk_request, elem);
+          if (r->disk > q->head_disk
+              || (r->disk == q->head_disk && r->sector >= q->head_pos))
+            {
+              next = r;
+              break;
+            }
+        }
+    }
+
+  if (next == NULL)
+    next = list_entry (list_front (&q->requests), struct disk_request, elem);
+
+  list_remove (&next->elem);
+  q->pending--;
+  q->head_disk = next->disk;
+  q->head_pos = next->sector + next->span;
+  q->dispatch_cnt++;
+  return next;
+}
+
+/* Marks R, a request taken from Q, as completed and accounts for
+   it in Q's statistics.  Does not wake up R's submitter.
+   The caller must serialize access to Q. */
+void
+iosched_complete (struct iosched_queue *q, struct disk_request *r)
+{
+  int64_t now = timer_ticks ();
+  int64_t latency = now - r->submit_time;
+  int bucket;
+
+  for (bucket = 0; bucket < IOSCHED_HIST_CNT - 1; bucket++)
+    if (latency < (1 << bucket))
+      break;
+  q->hist[bucket]++;
+
+  q->request_cnt++;
+  q->sector_cnt += r->cnt;
+  q->latency_sum += latency;
+  if (latency > q->max_latency)
+    q->max_latency = latency;
+  q->last_tick = now;
+  r->completed = true;
+}
+
+/* Returns the upper bound, in ticks, of the latency bucket below
+   which PERMILLE thousandths of Q's requests completed. */
+static int
+latency_percentile (const struct iosched_queue *q, int permille)
+{
+  long long seen = 0;
+  int bucket;
+
+  for (bucket = 0; bucket < IOSCHED_HIST_CNT - 1; bucket++)
+    {
+      seen += q->hist[bucket];
+      if (seen * 1000 >= q->request_cnt * permille)
+        break;
+    }
+  return 1 << bucket;
+}
+
+/* Prints Q's statistics, labeled with NAME. */
+void
+iosched_print_stats (const struct iosched_queue *q, const char *name)
+{
+  int64_t elapsed;
+
+  if (q->request_cnt == 0)
+    return;
+
+  elapsed = q->last_tick - q->first_tick;
+  if (elapsed <= 0)
+    elapsed = 1;
+  printf ("%s: %s: %lld requests, %lld merged, %lld commands, "
+          "%lld expired\n",
+          name, iosched_policy_name (), q->request_cnt, q->merge_cnt,
+          q->dispatch_cnt, q->expire_cnt);
+  printf ("%s: latency avg %lld, p50 <%d, p99 <%d, max %lld ticks; "
+          "%lld sectors/s\n",
+          name, q->latency_sum / q->request_cnt,
+          latency_percentile (q, 500), latency_percentile (q, 990),
+          (long long) q->max_latency,
+          q->sector_cnt * TIMER_FREQ / elapsed);
+}
+
+/* Orders requests by disk, then by sector. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+  const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+  if (a->disk != b->disk)
+    return a->disk < b->disk;
+  return a->sector < b->sector;
+}
+
+/* Tries to merge R into a queued request in Q that is adjacent
+   to it on disk.  Returns true if successful, false if R must be
+   queued on its own. */
+static bool
+try_merge (struct iosched_queue *q, struct disk_request *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct disk_request *h = list_entry (e, struct disk_request, elem);
+
+      if (h->disk != r->disk || h->write != r->write
+          || h->span + r->cnt > IOSCHED_MAX_SECTORS)
+        continue;
+
+      if (h->sector + h->span == r->sector)
+        {
+          /* Back merge: R follows H. */
+          list_push_back (&h->merged, &r->elem);
+          h->span += r->cnt;
+          if (r->deadline < h->deadline)
+            h->deadline = r->deadline;
+          return true;
+        }
+      else if (r->sector + r->cnt == h->sector)
+        {
+          /* Front merge: R takes H's place in the queue, and H
+             and everything merged into it follow R. */
+          list_insert (&h->elem, &r->elem);
+          list_remove (&h->elem);
+          list_push_back (&r->merged, &h->elem);
+          list_splice (list_end (&r->merged),
+                       list_begin (&h->merged), list_end (&h->merged));
+          r->span = r->cnt + h->span;
+          if (h->deadline < r->deadline)
+            r->deadline = h->deadline;
+          return true;
+        }
+    }
+  return false;
+}
@@ -0,0 +1,88 @@
+#ifndef DEVICES_IOSCHED_H
+#define DEVICES_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/disk.h"
+#include "threads/synch.h"
+
+/* Disk request scheduling policies. */
+enum iosched_policy
+  {
+    IOSCHED_NOOP,               /* First come, first served. */
+    IOSCHED_CSCAN,              /* Circular elevator. */
+    IOSCHED_DEADLINE            /* Elevator with expiration times. */
+  };
+
+/* Policy in use, selected with the -iosched kernel option. */
+extern enum iosched_policy iosched_policy;
+
+/* Most sectors a single request, or a merged run of requests,
+   may transfer.  Each such run becomes one ATA command. */
+#define IOSCHED_MAX_SECTORS 128
+
+/* A request to transfer CNT consecutive sectors between a disk
+   and BUFFER.
+
+   Requests that are adjacent on disk may be merged into a single
+   transfer.  The request at the head of such a transfer is the
+   one in the queue; the rest hang off its `merged' list in
+   ascending sector order. */
+struct disk_request
+  {
+    struct list_elem elem;      /* Queue or `merged' list element. */
+    struct disk *disk;          /* Disk to access. */
+    disk_sector_t sector;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+    bool write;                 /* True: write, false: read. */
+
+    struct list merged;         /* Requests merged behind this one. */
+    size_t span;                /* Sectors covered, including merged. */
+
+    int64_t submit_time;        /* Timer tick of submission. */
+    int64_t deadline;           /* Tick by which to dispatch. */
+    bool completed;             /* Transfer finished? */
+    bool dispatch;              /* Handed the dispatcher role? */
+    struct semaphore done;      /* Up'd on completion or hand-off. */
+  };
+
+/* Latency histogram buckets: bucket I counts requests that took
+   less than 2**I timer ticks, the last one everything slower. */
+#define IOSCHED_HIST_CNT 16
+
+/* A queue of pending requests for one ATA channel. */
+struct iosched_queue
+  {
+    struct list requests;       /* Pending requests. */
+    size_t pending;             /* Number of queued requests. */
+    disk_sector_t head_pos;     /* Sector just past the last transfer. */
+    struct disk *head_disk;     /* Disk of the last transfer. */
+
+    /* Statistics. */
+    long long request_cnt;      /* Requests completed. */
+    long long merge_cnt;        /* Requests merged into another. */
+    long long dispatch_cnt;     /* ATA commands issued. */
+    long long expire_cnt;       /* Dispatched because of a deadline. */
+    long long sector_cnt;       /* Sectors transferred. */
+    int64_t first_tick;         /* Submission tick of the first request. */
+    int64_t last_tick;          /* Completion tick of the last request. */
+    int64_t max_latency;        /* Worst latency, in ticks. */
+    long long latency_sum;      /* Sum of latencies, in ticks. */
+    long long hist[IOSCHED_HIST_CNT]; /* Latency histogram. */
+  };
+
+bool iosched_set_policy (const char *name);
+const char *iosched_policy_name (void);
+
+void iosched_init (struct iosched_queue *);
+void iosched_request_init (struct disk_request *, struct disk *,
+                           disk_sector_t, size_t cnt, void *, bool write);
+void iosched_add (struct iosched_queue *, struct disk_request *);
+struct disk_request *iosched_next (struct iosched_queue *);
+void iosched_complete (struct iosched_queue *, struct disk_request *);
+void iosched_print_stats (const struct iosched_queue *, const char *name);
+
+#endif /* devices/iosched.h */
@@ -1,6 +1,8 @@
 /* cat.c
 
-Copies one file to another. */
+Copies one file to another.  Where the file system supports it,
+the copy shares the original's data sectors instead of copying
+them. */
 
 #include <stdio.h>
 #include <syscall.h>
@@ -16,6 +18,10 @@ main (int argc, char *argv[])
       return EXIT_FAILURE;
     }
 
+  /* Clone the file if possible. */
+  if (reflink (argv[1], argv[2]))
+    return EXIT_SUCCESS;
+
   /* Open input file. */
   in_fd = open (argv[1]);
   if (in_fd < 0) 
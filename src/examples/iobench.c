@@ -0,0 +1,412 @@
+/* iobench.c
+
+   Disk I/O benchmark for comparing the kernel's I/O schedulers.
+
+   Usage: iobench <procs>
+          iobench -s <kB>
+          iobench -a <kB>
+          iobench -f <procs>
+          iobench -r <kB>
+
+   The first form starts PROCS child processes, each of which
+   does a mix of random-offset reads and writes on a file of its
+   own, so that the disk sees interleaved requests from several
+   sources at once.  Run it once per policy, e.g.
+
+        pintos -p iobench -a iobench -- -q -f -iosched=noop \
+          put iobench run 'iobench 4'
+
+   and compare the throughput and latency figures that the
+   kernel prints for hd0 at power-off.
+
+   The second form writes and then reads back a KB-kilobyte file
+   sequentially.  Running it with and without the -nodma kernel
+   option compares bus-master DMA against PIO: the kernel prints
+   the throughput and the CPU cycles spent per megabyte moved.
+
+   The third form grows an empty file to KB kilobytes by many
+   small appends, then reads it back and checks it.  The kernel's
+   disk statistics show how many commands and sectors the appends
+   cost, which is what delayed allocation is meant to cut.
+
+   The fourth form starts PROCS child processes that each append
+   records to a file of their own, calling fsync() after every
+   record, like a database writing its log.  The journal
+   statistics that the kernel prints at power-off show how many
+   commits the syncs cost: with group commit, concurrent syncs
+   share commits, so there are far fewer commits than syncs.
+
+   The fifth form writes a KB-kilobyte file, then reads it back
+   several times with page-aligned reads of LARGE_READ_SIZE
+   bytes each.  Such reads go from disk straight into the
+   caller's buffer, so comparing the read throughput that the
+   kernel prints against the second form shows what copying
+   through small buffers costs. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Maximum number of child processes. */
+#define MAX_PROCS 16
+
+/* Size of each child's file, in bytes. */
+#define FILE_SIZE (64 * 1024)
+
+/* Size of one I/O, in bytes. */
+#define BLOCK_SIZE 512
+
+/* Number of I/Os per child. */
+#define IO_CNT 256
+
+/* Size of one append, in bytes. */
+#define APPEND_SIZE 100
+
+/* Number of records each fsync child writes. */
+#define SYNC_CNT 32
+
+/* Buffer size for sequential I/O, in bytes. */
+#define SEQ_BUF_SIZE 4096
+
+/* Size of one large read, in bytes, and how many times the
+   large-read form reads its file. */
+#define LARGE_READ_SIZE (64 * 1024)
+#define LARGE_READ_PASSES 4
+
+static char block[BLOCK_SIZE];
+static char seq_buf[SEQ_BUF_SIZE];
+static char large_buf[LARGE_READ_SIZE] __attribute__ ((aligned (4096)));
+
+/* Writes and reads back a KB-kilobyte file sequentially. */
+static int
+sequential (int kb)
+{
+  const char *file = "iobench.seq";
+  int size = kb * 1024;
+  int ofs;
+  int fd;
+
+  if (kb <= 0 || !create (file, size))
+    {
+      printf ("%s: create failed\n", file);
+      return EXIT_FAILURE;
+    }
+  fd = open (file);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", file);
+      return EXIT_FAILURE;
+    }
+
+  memset (seq_buf, 0x5a, sizeof seq_buf);
+  for (ofs = 0; ofs < size; ofs += SEQ_BUF_SIZE)
+    {
+      int chunk = size - ofs < SEQ_BUF_SIZE ? size - ofs : SEQ_BUF_SIZE;
+      if (write (fd, seq_buf, chunk) != chunk)
+        {
+          printf ("%s: write failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < size; ofs += SEQ_BUF_SIZE)
+    {
+      int chunk = size - ofs < SEQ_BUF_SIZE ? size - ofs : SEQ_BUF_SIZE;
+      if (read (fd, seq_buf, chunk) != chunk)
+        {
+          printf ("%s: read failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+
+  printf ("iobench: wrote and read %d kB sequentially\n", kb);
+  return EXIT_SUCCESS;
+}
+
+/* Writes a KB-kilobyte file, then reads it back
+   LARGE_READ_PASSES times, LARGE_READ_SIZE bytes at a time, and
+   checks its contents. */
+static int
+large_read (int kb)
+{
+  const char *file = "iobench.big";
+  int size = kb * 1024;
+  int pass, ofs;
+  int fd;
+
+  if (kb <= 0 || !create (file, 0))
+    {
+      printf ("%s: create failed\n", file);
+      return EXIT_FAILURE;
+    }
+  fd = open (file);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", file);
+      return EXIT_FAILURE;
+    }
+
+  for (ofs = 0; ofs < size; ofs += SEQ_BUF_SIZE)
+    {
+      int chunk = size - ofs < SEQ_BUF_SIZE ? size - ofs : SEQ_BUF_SIZE;
+      memset (seq_buf, ofs / SEQ_BUF_SIZE, chunk);
+      if (write (fd, seq_buf, chunk) != chunk)
+        {
+          printf ("%s: write failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+
+  for (pass = 0; pass < LARGE_READ_PASSES; pass++)
+    {
+      seek (fd, 0);
+      for (ofs = 0; ofs < size; ofs += LARGE_READ_SIZE)
+        {
+          int chunk = (size - ofs < LARGE_READ_SIZE
+                       ? size - ofs : LARGE_READ_SIZE);
+          int i;
+
+          if (read (fd, large_buf, chunk) != chunk)
+            {
+              printf ("%s: read failed\n", file);
+              return EXIT_FAILURE;
+            }
+          for (i = 0; i < chunk; i += SEQ_BUF_SIZE)
+            if (large_buf[i] != (char) ((ofs + i) / SEQ_BUF_SIZE))
+              {
+                printf ("%s: bad data at offset %d\n", file, ofs + i);
+                return EXIT_FAILURE;
+              }
+        }
+    }
+  close (fd);
+
+  printf ("iobench: read %d kB %d times in %d kB reads\n",
+          kb, LARGE_READ_PASSES, LARGE_READ_SIZE / 1024);
+  return EXIT_SUCCESS;
+}
+
+/* Grows an empty file to KB kilobytes, APPEND_SIZE bytes at a
+   time, then reads it back and verifies it. */
+static int
+append (int kb)
+{
+  const char *file = "iobench.app";
+  int size = kb * 1024;
+  int ofs;
+  int fd;
+
+  if (kb <= 0 || !create (file, 0))
+    {
+      printf ("%s: create failed\n", file);
+      return EXIT_FAILURE;
+    }
+  fd = open (file);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", file);
+      return EXIT_FAILURE;
+    }
+
+  for (ofs = 0; ofs < size; ofs += APPEND_SIZE)
+    {
+      int chunk = size - ofs < APPEND_SIZE ? size - ofs : APPEND_SIZE;
+      memset (block, ofs / APPEND_SIZE, chunk);
+      if (write (fd, block, chunk) != chunk)
+        {
+          printf ("%s: append failed at offset %d\n", file, ofs);
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+
+  fd = open (file);
+  if (fd < 0 || filesize (fd) != size)
+    {
+      printf ("%s: wrong size after reopening\n", file);
+      return EXIT_FAILURE;
+    }
+  for (ofs = 0; ofs < size; ofs += APPEND_SIZE)
+    {
+      int chunk = size - ofs < APPEND_SIZE ? size - ofs : APPEND_SIZE;
+      int i;
+
+      if (read (fd, block, chunk) != chunk)
+        {
+          printf ("%s: read failed\n", file);
+          return EXIT_FAILURE;
+        }
+      for (i = 0; i < chunk; i++)
+        if (block[i] != (char) (ofs / APPEND_SIZE))
+          {
+            printf ("%s: bad data at offset %d\n", file, ofs + i);
+            return EXIT_FAILURE;
+          }
+    }
+  close (fd);
+
+  printf ("iobench: appended %d kB in %d-byte writes\n", kb, APPEND_SIZE);
+  return EXIT_SUCCESS;
+}
+
+/* Child process: append SYNC_CNT records of BLOCK_SIZE bytes to a
+   new file, syncing after each one. */
+static int
+sync_child (int idx)
+{
+  char file[32];
+  int fd;
+  int i;
+
+  snprintf (file, sizeof file, "iobench.f%d", idx);
+  if (!create (file, 0))
+    {
+      printf ("%s: create failed\n", file);
+      return EXIT_FAILURE;
+    }
+  fd = open (file);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", file);
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < SYNC_CNT; i++)
+    {
+      memset (block, i, sizeof block);
+      if (write (fd, block, sizeof block) != BLOCK_SIZE || !fsync (fd))
+        {
+          printf ("%s: write failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+  return EXIT_SUCCESS;
+}
+
+/* Child process: read or write IO_CNT random blocks of FILE. */
+static int
+child (int idx)
+{
+  char file[32];
+  int fd;
+  int i;
+
+  snprintf (file, sizeof file, "iobench.%d", idx);
+  fd = open (file);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", file);
+      return EXIT_FAILURE;
+    }
+
+  random_init (idx);
+  for (i = 0; i < IO_CNT; i++)
+    {
+      unsigned ofs = random_ulong () % (FILE_SIZE / BLOCK_SIZE) * BLOCK_SIZE;
+
+      seek (fd, ofs);
+      if (random_ulong () % 4 == 0)
+        {
+          memset (block, i, sizeof block);
+          if (write (fd, block, sizeof block) != BLOCK_SIZE)
+            {
+              printf ("%s: write failed\n", file);
+              return EXIT_FAILURE;
+            }
+        }
+      else if (read (fd, block, sizeof block) != BLOCK_SIZE)
+        {
+          printf ("%s: read failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+  close (fd);
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char *argv[])
+{
+  pid_t children[MAX_PROCS];
+  const char *child_opt = "-c";
+  int proc_cnt;
+  int failures = 0;
+  int i;
+
+  if (argc == 3 && !strcmp (argv[1], "-c"))
+    return child (atoi (argv[2]));
+  if (argc == 3 && !strcmp (argv[1], "-F"))
+    return sync_child (atoi (argv[2]));
+  if (argc == 3 && !strcmp (argv[1], "-s"))
+    return sequential (atoi (argv[2]));
+  if (argc == 3 && !strcmp (argv[1], "-a"))
+    return append (atoi (argv[2]));
+  if (argc == 3 && !strcmp (argv[1], "-r"))
+    return large_read (atoi (argv[2]));
+
+  if (argc == 3 && !strcmp (argv[1], "-f"))
+    {
+      child_opt = "-F";
+      argc--;
+      argv++;
+    }
+  if (argc != 2)
+    {
+      printf ("usage: iobench <procs>\n"
+              "       iobench -s <kB>\n"
+              "       iobench -a <kB>\n"
+              "       iobench -f <procs>\n"
+              "       iobench -r <kB>\n");
+      return EXIT_FAILURE;
+    }
+  proc_cnt = atoi (argv[1]);
+  if (proc_cnt < 1 || proc_cnt > MAX_PROCS)
+    {
+      printf ("iobench: procs must be between 1 and %d\n", MAX_PROCS);
+      return EXIT_FAILURE;
+    }
+
+  /* Create one file per child.  Syncing children create their
+     own. */
+  for (i = 0; i < proc_cnt && !strcmp (child_opt, "-c"); i++)
+    {
+      char file[32];
+
+      snprintf (file, sizeof file, "iobench.%d", i);
+      if (!create (file, FILE_SIZE))
+        {
+          printf ("%s: create failed\n", file);
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Run the children concurrently. */
+  for (i = 0; i < proc_cnt; i++)
+    {
+      char cmd[32];
+
+      snprintf (cmd, sizeof cmd, "iobench %s %d", child_opt, i);
+      children[i] = exec (cmd);
+      if (children[i] == PID_ERROR)
+        {
+          printf ("iobench: exec failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  for (i = 0; i < proc_cnt; i++)
+    if (wait (children[i]) != EXIT_SUCCESS)
+      failures++;
+
+  if (!strcmp (child_opt, "-F"))
+    printf ("iobench: %d processes, %d synced writes of %d bytes each, "
+            "%d failed\n", proc_cnt, SYNC_CNT, BLOCK_SIZE, failures);
+  else
+    printf ("iobench: %d processes, %d I/Os of %d bytes each, %d failed\n",
+            proc_cnt, IO_CNT, BLOCK_SIZE, failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
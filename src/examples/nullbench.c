@@ -0,0 +1,70 @@
+/* nullbench.c
+
+   System call latency benchmark.
+
+   Usage: nullbench [<calls>]
+
+   Makes CALLS system calls (by default, DEFAULT_CALLS) that do no
+   work, namely tell() on the console, which the kernel answers
+   without touching the file system.  Times them with the CPU's
+   time-stamp counter and prints the average cost of one call in
+   CPU cycles, which is the fixed cost of entering the kernel,
+   dispatching the call, and returning to the user program.
+
+   It does this twice, first entering the kernel with
+   "int $0x30" and then with SYSENTER, if the CPU has it, to
+   compare the two entry paths. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Number of calls to make if not given on the command line. */
+#define DEFAULT_CALLS 100000
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Makes CALLS null system calls and prints their average cost,
+   labeled with HOW they entered the kernel. */
+static void
+run (const char *how, int calls) 
+{
+  uint64_t start, cycles;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < calls; i++)
+    tell (STDIN_FILENO);
+  cycles = rdtsc () - start;
+
+  printf ("nullbench: %s: %d calls, %llu CPU cycles per call\n",
+          how, calls, cycles / calls);
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  int calls = argc > 1 ? atoi (argv[1]) : DEFAULT_CALLS;
+
+  if (argc > 2 || calls <= 0)
+    {
+      printf ("usage: nullbench [<calls>]\n");
+      return EXIT_FAILURE;
+    }
+
+  syscall_use_sysenter (false);
+  run ("int $0x30", calls);
+  if (syscall_use_sysenter (true))
+    run ("sysenter", calls);
+  else
+    printf ("nullbench: CPU does not support sysenter\n");
+  return EXIT_SUCCESS;
+}
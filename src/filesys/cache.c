@@ -0,0 +1,413 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Metadata buffer cache.
+
+   Holds recently used sectors of file system metadata: inodes,
+   indirect extent blocks, and the contents of directories and
+   the free map.  Regular file data does not pass through here.
+
+   Writes only change the cached copy.  While the journal is
+   active, every sector written belongs to the journal's running
+   transaction, identified by the entry's TID, and may not reach
+   its home location until that transaction has been committed to
+   the journal: such entries are pinned.  Once committed, a dirty
+   entry may be written back whenever it is evicted, and all of
+   them are written back when the journal checkpoints.  While the
+   journal is inactive, RUNNING_TID is 0 and dirty entries may be
+   written back at any time.
+
+   At most CACHE_SIZE entries are kept, except that pinned
+   entries are never evicted, so a large transaction can make the
+   cache grow beyond that until it commits.  The least recently
+   used evictable entry is replaced.
+
+   CACHE_LOCK protects everything here but is not held across
+   disk I/O.  An entry being read or written back is marked busy,
+   and anyone who needs it waits on IO_DONE. */
+
+/* Nominal number of cached sectors. */
+#define CACHE_SIZE 64
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in ENTRIES. */
+    struct list_elem lru_elem;          /* Element in LRU. */
+    disk_sector_t sector;               /* Sector cached. */
+    bool busy;                          /* Being read or written back. */
+    bool dirty;                         /* Differs from disk. */
+    unsigned tid;                       /* Transaction that last wrote it. */
+    uint8_t data[DISK_SECTOR_SIZE];     /* Sector contents. */
+  };
+
+static struct hash entries;             /* All cached sectors. */
+static struct list lru;                 /* Most recently used first. */
+static size_t entry_cnt;                /* Number of entries. */
+static struct lock cache_lock;          /* Protects the above. */
+static struct condition io_done;        /* Signaled when I/O finishes. */
+
+/* Journal state, see above. */
+static unsigned running_tid;            /* Transaction writes join. */
+static unsigned committed_tid;          /* Last committed transaction. */
+static size_t running_cnt;              /* Entries in RUNNING_TID. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Accesses found in the cache. */
+static long long miss_cnt;              /* Accesses that went to disk. */
+
+static unsigned entry_hash (const struct hash_elem *, void *aux);
+static bool entry_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
+static struct cache_entry *get_entry (disk_sector_t, bool load);
+static void mark_dirty (struct cache_entry *);
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  hash_init (&entries, entry_hash, entry_less, NULL);
+  list_init (&lru);
+  entry_cnt = 0;
+  lock_init (&cache_lock);
+  cond_init (&io_done);
+  running_tid = committed_tid = 0;
+  running_cnt = 0;
+}
+
+/* Reads sector SECTOR into BUFFER, which must have room for
+   DISK_SECTOR_SIZE bytes. */
+void
+cache_read (disk_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, DISK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at offset OFS within sector SECTOR
+   into BUFFER. */
+void
+cache_read_at (disk_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&cache_lock);
+}
+
+/* Writes DISK_SECTOR_SIZE bytes from BUFFER into sector SECTOR. */
+void
+cache_write (disk_sector_t sector, const void *buffer)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, false);
+  memcpy (e->data, buffer, DISK_SECTOR_SIZE);
+  mark_dirty (e);
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER into sector SECTOR starting at
+   offset OFS within the sector. */
+void
+cache_write_at (disk_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = get_entry (sector, size < DISK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  mark_dirty (e);
+  lock_release (&cache_lock);
+}
+
+/* Drops the CNT sectors starting at SECTOR from the cache without
+   writing them back, because they have been freed and may be
+   reused for file data that does not pass through the cache. */
+void
+cache_discard (disk_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry key;
+      struct hash_elem *he;
+
+      key.sector = sector + i;
+      while ((he = hash_find (&entries, &key.hash_elem)) != NULL)
+        {
+          struct cache_entry *e = hash_entry (he, struct cache_entry,
+                                              hash_elem);
+          if (e->busy)
+            {
+              cond_wait (&io_done, &cache_lock);
+              continue;
+            }
+          if (e->dirty && e->tid == running_tid && running_tid != 0)
+            running_cnt--;
+          hash_delete (&entries, &e->hash_elem);
+          list_remove (&e->lru_elem);
+          entry_cnt--;
+          free (e);
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector that may go home, i.e. all of them
+   except those written by uncommitted transactions, back to
+   disk. */
+void
+cache_flush (void)
+{
+  struct list_elem *le;
+
+  lock_acquire (&cache_lock);
+  le = list_begin (&lru);
+  while (le != list_end (&lru))
+    {
+      struct cache_entry *e = list_entry (le, struct cache_entry, lru_elem);
+      if (e->busy)
+        {
+          /* It may be on its way home, but not there yet. */
+          cond_wait (&io_done, &cache_lock);
+          le = list_begin (&lru);
+          continue;
+        }
+      if (!e->dirty || e->tid > committed_tid)
+        {
+          le = list_next (le);
+          continue;
+        }
+
+      e->busy = true;
+      lock_release (&cache_lock);
+      disk_write (filesys_disk, e->sector, e->data);
+      lock_acquire (&cache_lock);
+      e->busy = false;
+      e->dirty = false;
+      cond_broadcast (&io_done, &cache_lock);
+
+      /* The list may have changed while the lock was dropped. */
+      le = list_begin (&lru);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses\n", hit_cnt, miss_cnt);
+}
+
+/* Journal interface. */
+
+/* Sets the running transaction, which new writes join, to
+   RUNNING, and the last committed one to COMMITTED.  A RUNNING
+   of 0 means that the journal is inactive. */
+void
+cache_set_tids (unsigned running, unsigned committed)
+{
+  lock_acquire (&cache_lock);
+  running_tid = running;
+  committed_tid = committed;
+  running_cnt = 0;
+  cond_broadcast (&io_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the number of sectors written by the running
+   transaction. */
+size_t
+cache_running_cnt (void)
+{
+  return running_cnt;
+}
+
+/* Ends the running transaction and starts the next one.  Copies
+   the sector numbers and contents of up to MAX of the sectors
+   the ended transaction wrote into SECTORS and IMAGES, and
+   returns how many it wrote in all, which may be more than MAX. */
+size_t
+cache_collect (disk_sector_t *sectors, void *images_, size_t max)
+{
+  uint8_t *images = images_;
+  struct list_elem *le;
+  size_t cnt = 0;
+
+  lock_acquire (&cache_lock);
+  ASSERT (running_tid != 0);
+  for (le = list_begin (&lru); le != list_end (&lru); le = list_next (le))
+    {
+      struct cache_entry *e = list_entry (le, struct cache_entry, lru_elem);
+      if (e->dirty && e->tid == running_tid)
+        {
+          if (cnt < max)
+            {
+              sectors[cnt] = e->sector;
+              memcpy (images + cnt * DISK_SECTOR_SIZE, e->data,
+                      DISK_SECTOR_SIZE);
+            }
+          cnt++;
+        }
+    }
+  running_tid++;
+  running_cnt = 0;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Notes that transaction TID has been committed, which lets the
+   sectors it wrote go home. */
+void
+cache_set_committed (unsigned tid)
+{
+  lock_acquire (&cache_lock);
+  committed_tid = tid;
+  cond_broadcast (&io_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns a hash value for cache entry E. */
+static unsigned
+entry_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+  const struct cache_entry *e = hash_entry (e_, struct cache_entry,
+                                            hash_elem);
+  return hash_int (e->sector);
+}
+
+/* Returns true if cache entry A precedes cache entry B. */
+static bool
+entry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct cache_entry *a = hash_entry (a_, struct cache_entry,
+                                            hash_elem);
+  const struct cache_entry *b = hash_entry (b_, struct cache_entry,
+                                            hash_elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the least recently used entry that may be evicted, or
+   a null pointer if there is none.  cache_lock must be held. */
+static struct cache_entry *
+find_victim (void)
+{
+  struct list_elem *le;
+
+  for (le = list_rbegin (&lru); le != list_rend (&lru); le = list_prev (le))
+    {
+      struct cache_entry *e = list_entry (le, struct cache_entry, lru_elem);
+      if (!e->busy && (!e->dirty || e->tid <= committed_tid))
+        return e;
+    }
+  return NULL;
+}
+
+/* Returns the entry for SECTOR, bringing it into the cache if
+   necessary, and marks it most recently used.  A new entry's
+   data is read from disk if LOAD is true and left as garbage for
+   the caller to overwrite otherwise.  Only returns an entry that
+   is not busy.  cache_lock must be held. */
+static struct cache_entry *
+get_entry (disk_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      struct cache_entry key;
+      struct hash_elem *he;
+
+      key.sector = sector;
+      he = hash_find (&entries, &key.hash_elem);
+      if (he != NULL)
+        {
+          e = hash_entry (he, struct cache_entry, hash_elem);
+          if (e->busy)
+            {
+              cond_wait (&io_done, &cache_lock);
+              continue;
+            }
+          hit_cnt++;
+          list_remove (&e->lru_elem);
+          list_push_front (&lru, &e->lru_elem);
+          return e;
+        }
+
+      /* Miss.  Recycle the least recently used entry if the cache
+         is full and one can go, writing it back first if it is
+         dirty.  Writing back drops the lock, so start over after
+         that. */
+      e = entry_cnt >= CACHE_SIZE ? find_victim () : NULL;
+      if (e != NULL && e->dirty)
+        {
+          e->busy = true;
+          lock_release (&cache_lock);
+          disk_write (filesys_disk, e->sector, e->data);
+          lock_acquire (&cache_lock);
+          e->busy = false;
+          e->dirty = false;
+          cond_broadcast (&io_done, &cache_lock);
+          continue;
+        }
+      if (e != NULL)
+        {
+          hash_delete (&entries, &e->hash_elem);
+          list_remove (&e->lru_elem);
+        }
+      else
+        {
+          e = malloc (sizeof *e);
+          if (e == NULL)
+            PANIC ("out of memory for buffer cache");
+          entry_cnt++;
+        }
+      miss_cnt++;
+      e->sector = sector;
+      e->dirty = false;
+      e->tid = 0;
+      e->busy = load;
+      hash_insert (&entries, &e->hash_elem);
+      list_push_front (&lru, &e->lru_elem);
+      if (!load)
+        return e;
+
+      lock_release (&cache_lock);
+      disk_read (filesys_disk, sector, e->data);
+      lock_acquire (&cache_lock);
+      e->busy = false;
+      cond_broadcast (&io_done, &cache_lock);
+      return e;
+    }
+}
+
+/* Marks E dirty as part of the running transaction.
+   cache_lock must be held. */
+static void
+mark_dirty (struct cache_entry *e)
+{
+  if (running_tid != 0 && !(e->dirty && e->tid == running_tid))
+    running_cnt++;
+  e->dirty = true;
+  e->tid = running_tid;
+}
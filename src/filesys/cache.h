@@ -0,0 +1,22 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+void cache_init (void);
+void cache_read (disk_sector_t, void *);
+void cache_read_at (disk_sector_t, void *, int ofs, int size);
+void cache_write (disk_sector_t, const void *);
+void cache_write_at (disk_sector_t, const void *, int ofs, int size);
+void cache_discard (disk_sector_t, size_t cnt);
+void cache_flush (void);
+void cache_print_stats (void);
+
+/* Interface to the journal. */
+void cache_set_tids (unsigned running, unsigned committed);
+size_t cache_running_cnt (void);
+size_t cache_collect (disk_sector_t *sectors, void *images, size_t max);
+void cache_set_committed (unsigned tid);
+
+#endif /* filesys/cache.h */
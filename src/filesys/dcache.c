@@ -0,0 +1,249 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the results of recent directory lookups, keyed by
+   the directory's inode sector and the name looked up, so that
+   opening the same name again does not have to open or read the
+   directory at all.  Failed lookups are remembered too, as
+   "absent" entries, since looking for a file that does not exist
+   (e.g. before creating it) would otherwise scan the whole
+   directory every time.
+
+   The directory code keeps the cache coherent: it records what
+   it finds and updates the entry for a name whenever it adds or
+   removes that name, all while holding its own lock, so a stale
+   result can never be cached.
+
+   At most DCACHE_SIZE entries are kept.  The least recently used
+   one is replaced when the cache is full. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_SIZE 256
+
+/* A cached directory entry. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in DENTRIES. */
+    struct list_elem lru_elem;          /* Element in LRU. */
+    disk_sector_t dir;                  /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within DIR. */
+    bool absent;                        /* True if NAME does not exist. */
+    disk_sector_t sector;               /* NAME's inode, if !ABSENT. */
+  };
+
+static struct hash dentries;            /* All cached entries. */
+static struct list lru;                 /* Most recently used first. */
+static size_t dentry_cnt;               /* Number of cached entries. */
+static struct lock dcache_lock;         /* Protects the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups answered "found". */
+static long long absent_cnt;            /* Lookups answered "absent". */
+static long long miss_cnt;              /* Lookups not answered. */
+
+static unsigned dentry_hash (const struct hash_elem *, void *aux);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+                         void *aux);
+static struct dentry *find (disk_sector_t dir, const char *name);
+static void insert (disk_sector_t dir, const char *name, bool absent,
+                    disk_sector_t sector);
+static void discard (struct dentry *);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void) 
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  dentry_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns DCACHE_FOUND and stores NAME's inode sector in *SECTOR
+   if NAME is known to exist, DCACHE_ABSENT if it is known not to,
+   and DCACHE_MISS if the directory must be searched. */
+enum dcache_result
+dcache_lookup (disk_sector_t dir, const char *name, disk_sector_t *sector) 
+{
+  enum dcache_result result = DCACHE_MISS;
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    miss_cnt++;
+  else 
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru, &d->lru_elem);
+      if (d->absent) 
+        {
+          result = DCACHE_ABSENT;
+          absent_cnt++;
+        }
+      else 
+        {
+          result = DCACHE_FOUND;
+          *sector = d->sector;
+          hit_cnt++;
+        }
+    }
+  lock_release (&dcache_lock);
+  return result;
+}
+
+/* Records that NAME in directory DIR has its inode in SECTOR. */
+void
+dcache_insert (disk_sector_t dir, const char *name, disk_sector_t sector) 
+{
+  insert (dir, name, false, sector);
+}
+
+/* Records that directory DIR has no entry NAME. */
+void
+dcache_insert_absent (disk_sector_t dir, const char *name) 
+{
+  insert (dir, name, true, 0);
+}
+
+/* Forgets anything known about NAME in directory DIR. */
+void
+dcache_invalidate (disk_sector_t dir, const char *name) 
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets everything known about directory DIR, e.g. because
+   sector DIR is being reused for a new directory. */
+void
+dcache_invalidate_dir (disk_sector_t dir) 
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next) 
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void) 
+{
+  printf ("Dentry cache: %lld hits, %lld negative hits, %lld misses\n",
+          hit_cnt, absent_cnt, miss_cnt);
+}
+
+/* Returns a hash value for dentry D. */
+static unsigned
+dentry_hash (const struct hash_elem *d_, void *aux UNUSED) 
+{
+  const struct dentry *d = hash_entry (d_, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer if
+   there is none.  dcache_lock must be held. */
+static struct dentry *
+find (disk_sector_t dir, const char *name) 
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&dcache_lock));
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Caches an entry for NAME in DIR, replacing any existing one. */
+static void
+insert (disk_sector_t dir, const char *name, bool absent,
+        disk_sector_t sector) 
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else if (dentry_cnt >= DCACHE_SIZE) 
+    {
+      /* Recycle the least recently used entry. */
+      d = list_entry (list_back (&lru), struct dentry, lru_elem);
+      list_remove (&d->lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  else 
+    {
+      d = malloc (sizeof *d);
+      if (d == NULL) 
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+      dentry_cnt++;
+    }
+  d->absent = absent;
+  d->sector = sector;
+  list_push_front (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Removes D from the cache and frees it.  dcache_lock must be
+   held. */
+static void
+discard (struct dentry *d) 
+{
+  hash_delete (&dentries, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  dentry_cnt--;
+  free (d);
+}
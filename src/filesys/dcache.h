@@ -0,0 +1,25 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Result of a directory entry cache lookup. */
+enum dcache_result
+  {
+    DCACHE_MISS,                /* Nothing known; search the directory. */
+    DCACHE_FOUND,               /* Name exists, in the given sector. */
+    DCACHE_ABSENT               /* Name is known not to exist. */
+  };
+
+void dcache_init (void);
+enum dcache_result dcache_lookup (disk_sector_t dir, const char *name,
+                                  disk_sector_t *sector);
+void dcache_insert (disk_sector_t dir, const char *name,
+                    disk_sector_t sector);
+void dcache_insert_absent (disk_sector_t dir, const char *name);
+void dcache_invalidate (disk_sector_t dir, const char *name);
+void dcache_invalidate_dir (disk_sector_t dir);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
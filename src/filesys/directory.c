@@ -1,38 +1,125 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* A directory. */
-struct dir 
-  {
-    struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
-  };
+/* Directory formats.
+
+   A small directory is a plain array of struct dir_entry, which
+   is searched linearly.  Once it holds DIR_INDEX_THRESHOLD
+   entries it is converted to the indexed format and its inode is
+   marked INODE_INDEXED:
+
+        - Block 0 holds a struct dir_index header.
+
+        - Blocks 1 through BUCKET_CNT are hash buckets.  An entry
+          named NAME lives in bucket 1 + hash_string (NAME) %
+          BUCKET_CNT, or in an overflow block chained from it.
+
+        - Overflow blocks follow the buckets, up to BLOCK_CNT.
+
+   Looking up, adding, or removing a name then reads one bucket
+   block plus the header, plus any overflow blocks in its chain.
+   When the buckets fill up past DIR_MAX_LOAD percent, the
+   directory is rebuilt with twice as many buckets, which keeps
+   chains short at an amortized constant cost per entry.
+
+   Either way, an entry's byte offset within the directory file
+   stays fixed until the directory is rebuilt, so code that only
+   rewrites an existing entry does not care about the format. */
 
 /* A single directory entry. */
-struct dir_entry 
+struct dir_entry
   {
     disk_sector_t inode_sector;         /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
   };
 
+/* Number of entries at which a linear directory becomes indexed. */
+#define DIR_INDEX_THRESHOLD 32
+
+/* Load factors, in percent of bucket slots in use, above which an
+   indexed directory is rebuilt, and that a rebuild aims for. */
+#define DIR_MAX_LOAD 75
+#define DIR_TARGET_LOAD 40
+
+/* Fewest buckets an indexed directory has. */
+#define DIR_MIN_BUCKETS 4
+
+/* Entries per bucket block. */
+#define BUCKET_ENTRY_CNT 25
+
+/* Header of an indexed directory, at the start of block 0.  The
+   rest of block 0 is not used. */
+struct dir_index
+  {
+    uint32_t bucket_cnt;                /* Number of hash buckets. */
+    uint32_t block_cnt;                 /* Blocks in use, with header. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+  };
+
+/* A bucket or overflow block of an indexed directory.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    uint32_t next;                      /* Overflow block, or 0. */
+    uint32_t unused[2];                 /* Not used. */
+    struct dir_entry entries[BUCKET_ENTRY_CNT]; /* Entries. */
+  };
+
+/* Byte offset of entry SLOT in block BLOCK of an indexed
+   directory. */
+#define ENTRY_OFS(BLOCK, SLOT)                                  \
+        ((off_t) (BLOCK) * DISK_SECTOR_SIZE                     \
+         + offsetof (struct dir_bucket, entries)                \
+         + (off_t) (SLOT) * sizeof (struct dir_entry))
+
+/* A directory. */
+struct dir
+  {
+    struct inode *inode;                /* Backing store. */
+    off_t pos;                          /* Current position. */
+  };
+
+/* Serializes directory operations.  Converting or rebuilding a
+   directory replaces its contents, which must not interleave
+   with lookups or other changes. */
+static struct lock dir_lock;
+
+static bool rebuild (struct dir *);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dir_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
-dir_create (disk_sector_t sector, size_t entry_cnt) 
+dir_create (disk_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  dcache_invalidate_dir (sector);
+  return inode_create (sector, entry_cnt * sizeof (struct dir_entry),
+                       INODE_JOURNALED);
 }
 
 /* Opens and returns the directory for the given INODE, of which
    it takes ownership.  Returns a null pointer on failure. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
@@ -45,7 +132,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -60,14 +147,14 @@ dir_open_root (void)
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
@@ -78,11 +165,44 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
+/* Returns true if DIR is in the indexed format. */
+static bool
+is_indexed (const struct dir *dir)
+{
+  return (inode_get_flags (dir->inode) & INODE_INDEXED) != 0;
+}
+
+/* Reads the header of indexed directory DIR into *INDEX.
+   Returns true if successful, false on failure. */
+static bool
+read_index (const struct dir *dir, struct dir_index *index)
+{
+  return inode_read_at (dir->inode, index, sizeof *index, 0)
+          == sizeof *index;
+}
+
+/* Writes *INDEX as the header of indexed directory DIR.
+   Returns true if successful, false on failure. */
+static bool
+write_index (struct dir *dir, const struct dir_index *index)
+{
+  return inode_write_at (dir->inode, index, sizeof *index, 0)
+          == sizeof *index;
+}
+
+/* Returns the bucket block for NAME in a directory with
+   BUCKET_CNT buckets. */
+static uint32_t
+bucket_of (const char *name, uint32_t bucket_cnt)
+{
+  return 1 + hash_string (name) % bucket_cnt;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -90,25 +210,91 @@ dir_get_inode (struct dir *dir)
    otherwise, returns false and ignores EP and OFSP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+        struct dir_entry *ep, off_t *ofsp)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  /* Either format is searched a block's worth of entries at a
+     time.  dir_lock serializes use of the buffer. */
+  static struct dir_bucket block_buf;
+  struct dir_bucket *b = &block_buf;
+  bool found = false;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
+  ASSERT (lock_held_by_current_thread (&dir_lock));
+
+  if (is_indexed (dir))
+    {
+      struct dir_index index;
+      uint32_t block;
+
+      if (!read_index (dir, &index))
+        goto done;
+      for (block = bucket_of (name, index.bucket_cnt); block != 0;
+           block = b->next)
+        {
+          size_t i;
+
+          if (inode_read_at (dir->inode, b, sizeof *b,
+                             (off_t) block * DISK_SECTOR_SIZE) != sizeof *b)
+            goto done;
+          for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+            if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+              {
+                if (ep != NULL)
+                  *ep = b->entries[i];
+                if (ofsp != NULL)
+                  *ofsp = ENTRY_OFS (block, i);
+                found = true;
+                goto done;
+              }
+        }
+    }
+  else
+    {
+      off_t ofs, size;
+
+      for (ofs = 0; (size = inode_read_at (dir->inode, b->entries,
+                                           sizeof b->entries, ofs)) > 0;
+           ofs += size)
+        {
+          size_t i;
+
+          for (i = 0; i < size / sizeof (struct dir_entry); i++)
+            if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+              {
+                if (ep != NULL)
+                  *ep = b->entries[i];
+                if (ofsp != NULL)
+                  *ofsp = ofs + i * sizeof (struct dir_entry);
+                found = true;
+                goto done;
+              }
+        }
+    }
+
+ done:
+  return found;
+}
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+/* Searches DIR for NAME after a directory entry cache miss,
+   caches the result, and sets *INODE to an inode for the file or
+   to a null pointer if there is none.  dir_lock must be held. */
+static void
+search (const struct dir *dir, const char *name, struct inode **inode)
+{
+  disk_sector_t dir_sector = inode_get_inumber (dir->inode);
+  struct dir_entry e;
+
+  if (lookup (dir, name, &e, NULL))
+    {
+      dcache_insert (dir_sector, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
+  else
+    {
+      dcache_insert_absent (dir_sector, name);
+      *inode = NULL;
+    }
 }
 
 /* Searches DIR for a file with the given NAME
@@ -117,21 +303,165 @@ lookup (const struct dir *dir, const char *name,
    a null pointer.  The caller must close *INODE. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
-  struct dir_entry e;
+  disk_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  lock_acquire (&dir_lock);
+  switch (dcache_lookup (inode_get_inumber (dir->inode), name, &sector))
+    {
+    case DCACHE_FOUND:
+      *inode = inode_open (sector);
+      break;
+    case DCACHE_ABSENT:
+      *inode = NULL;
+      break;
+    case DCACHE_MISS:
+      search (dir, name, inode);
+      break;
+    }
+  lock_release (&dir_lock);
+
+  return *inode != NULL;
+}
+
+/* Like dir_lookup(), but for the directory whose inode is in
+   DIR_SECTOR.  This is one step of a path walk: when the
+   directory entry cache knows NAME, the directory itself is not
+   opened, let alone read. */
+bool
+dir_lookup_at (disk_sector_t dir_sector, const char *name,
+               struct inode **inode)
+{
+  enum dcache_result result;
+  disk_sector_t sector;
+  struct dir *dir;
+
+  ASSERT (name != NULL);
+
+  lock_acquire (&dir_lock);
+  result = dcache_lookup (dir_sector, name, &sector);
+  *inode = result == DCACHE_FOUND ? inode_open (sector) : NULL;
+  lock_release (&dir_lock);
+  if (result != DCACHE_MISS)
+    return *inode != NULL;
+
+  dir = dir_open (inode_open (dir_sector));
+  if (dir == NULL)
+    return false;
+  lock_acquire (&dir_lock);
+  search (dir, name, inode);
+  lock_release (&dir_lock);
+  dir_close (dir);
 
   return *inode != NULL;
 }
 
+/* Stores E in the first free slot of linear directory DIR,
+   appending it if there are no free slots, and converts DIR to
+   the indexed format if it has become large enough.
+   Returns true if successful, false on failure. */
+static bool
+linear_add (struct dir *dir, const struct dir_entry *e)
+{
+  /* The directory is scanned a block's worth of entries at a
+     time.  dir_lock serializes use of the buffer. */
+  static struct dir_entry block_buf[BUCKET_ENTRY_CNT];
+  size_t used_cnt = 0;
+  off_t ofs = -1;
+  off_t pos, size;
+
+  /* inode_read_at() will only return a short read at end of
+     file.  Otherwise, we'd need to verify that we didn't get a
+     short read due to something intermittent such as low
+     memory. */
+  for (pos = 0; (size = inode_read_at (dir->inode, block_buf,
+                                       sizeof block_buf, pos)) > 0;
+       pos += size)
+    {
+      size_t i;
+
+      for (i = 0; i < size / sizeof *block_buf; i++)
+        if (block_buf[i].in_use)
+          used_cnt++;
+        else if (ofs < 0)
+          ofs = pos + i * sizeof *block_buf;
+    }
+  if (ofs < 0)
+    ofs = pos - pos % sizeof *block_buf;
+
+  if (inode_write_at (dir->inode, e, sizeof *e, ofs) != sizeof *e)
+    return false;
+  if (used_cnt + 1 >= DIR_INDEX_THRESHOLD)
+    rebuild (dir);
+  return true;
+}
+
+/* Stores E in indexed directory DIR, chaining a new overflow
+   block to its bucket if the bucket is full, and rebuilds DIR
+   with more buckets if it has become too full.
+   Returns true if successful, false on failure. */
+static bool
+indexed_add (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_index index;
+  struct dir_bucket *b;
+  uint32_t block;
+  bool success = false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL || !read_index (dir, &index))
+    goto done;
+
+  for (block = bucket_of (e->name, index.bucket_cnt); ; block = b->next)
+    {
+      size_t i;
+
+      if (inode_read_at (dir->inode, b, sizeof *b,
+                         (off_t) block * DISK_SECTOR_SIZE) != sizeof *b)
+        goto done;
+      for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+        if (!b->entries[i].in_use)
+          {
+            b->entries[i] = *e;
+            if (inode_write_at (dir->inode, b, sizeof *b,
+                                (off_t) block * DISK_SECTOR_SIZE)
+                != sizeof *b)
+              goto done;
+            goto added;
+          }
+      if (b->next == 0)
+        break;
+    }
+
+  /* Every block in the chain is full.  Write a new overflow block
+     first, then link it in, so that the chain is never broken. */
+  b->next = index.block_cnt++;
+  if (inode_write_at (dir->inode, b, sizeof *b,
+                      (off_t) block * DISK_SECTOR_SIZE) != sizeof *b)
+    goto done;
+  block = b->next;
+  memset (b, 0, sizeof *b);
+  b->entries[0] = *e;
+  if (inode_write_at (dir->inode, b, sizeof *b,
+                      (off_t) block * DISK_SECTOR_SIZE) != sizeof *b)
+    goto done;
+
+ added:
+  index.entry_cnt++;
+  success = write_index (dir, &index);
+  if (success && index.entry_cnt * 100
+                 > index.bucket_cnt * BUCKET_ENTRY_CNT * DIR_MAX_LOAD)
+    rebuild (dir);
+
+ done:
+  free (b);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -139,12 +469,13 @@ dir_lookup (const struct dir *dir, const char *name,
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
+dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
 {
+  disk_sector_t dir_sector = inode_get_inumber (dir->inode);
+  disk_sector_t sector;
   struct dir_entry e;
-  off_t ofs;
   bool success = false;
-  
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
@@ -152,29 +483,36 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  journal_begin ();
+  lock_acquire (&dir_lock);
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
+  /* Check that NAME is not in use. */
+  switch (dcache_lookup (dir_sector, name, &sector))
+    {
+    case DCACHE_FOUND:
+      goto done;
+    case DCACHE_ABSENT:
+      break;
+    case DCACHE_MISS:
+      if (lookup (dir, name, NULL, NULL))
+        goto done;
       break;
+    }
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = is_indexed (dir) ? indexed_add (dir, &e) : linear_add (dir, &e);
+  if (success)
+    dcache_insert (dir_sector, name, inode_sector);
+  else
+    dcache_invalidate (dir_sector, name);
 
  done:
+  lock_release (&dir_lock);
+  journal_end ();
   return success;
 }
 
@@ -182,7 +520,7 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
    Returns true if successful, false on failure,
    which occurs only if there is no file with the given NAME. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
@@ -192,6 +530,9 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  journal_begin ();
+  lock_acquire (&dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -203,15 +544,29 @@ dir_remove (struct dir *dir, const char *name)
 
   /* Erase directory entry. */
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  dcache_insert_absent (inode_get_inumber (dir->inode), name);
+  if (is_indexed (dir))
+    {
+      struct dir_index index;
+
+      if (read_index (dir, &index))
+        {
+          index.entry_cnt--;
+          write_index (dir, &index);
+        }
+    }
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&dir_lock);
   inode_close (inode);
+  journal_end ();
   return success;
 }
 
@@ -221,16 +576,246 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dirent d;
+
+  if (dir_readdir_many (dir, &d, 1) == 0)
+    return false;
+  strlcpy (name, d.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads up to MAX of the next entries in DIR into ENTRIES.
+   Returns the number of entries read, which is 0 once the
+   directory contains no more entries.  Entries are read a block
+   at a time and free slots are skipped without copying, so
+   listing a directory costs about one sector read per block. */
+size_t
+dir_readdir_many (struct dir *dir, struct dirent *entries, size_t max)
+{
+  static struct dir_entry block_buf[BUCKET_ENTRY_CNT];
+  bool indexed;
+  off_t end;
+  size_t cnt = 0;
+
+  ASSERT (dir != NULL);
+  ASSERT (entries != NULL);
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  lock_acquire (&dir_lock);
+  indexed = is_indexed (dir);
+  if (indexed)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      struct dir_index index;
+
+      if (!read_index (dir, &index))
+        goto done;
+      end = (off_t) index.block_cnt * DISK_SECTOR_SIZE;
+    }
+  else
+    end = inode_length (dir->inode);
+
+  while (cnt < max && dir->pos < end)
+    {
+      off_t size;
+      size_t i;
+
+      if (indexed)
+        {
+          /* Skip the header and block headers, and read no further
+             than the end of the current block. */
+          off_t block = dir->pos / DISK_SECTOR_SIZE;
+          off_t slot_ofs = dir->pos % DISK_SECTOR_SIZE
+                           - (off_t) offsetof (struct dir_bucket, entries);
+
+          if (block == 0)
+            dir->pos = ENTRY_OFS (1, 0);
+          else if (slot_ofs < 0)
+            dir->pos = ENTRY_OFS (block, 0);
+          else if (slot_ofs / sizeof *block_buf >= BUCKET_ENTRY_CNT)
+            dir->pos = ENTRY_OFS (block + 1, 0);
+          if (dir->pos >= end)
+            break;
+          size = (dir->pos / DISK_SECTOR_SIZE + 1) * DISK_SECTOR_SIZE
+                 - dir->pos;
+        }
+      else
+        size = sizeof block_buf;
+
+      size = inode_read_at (dir->inode, block_buf, size, dir->pos);
+      if (size < (off_t) sizeof *block_buf)
+        break;
+      for (i = 0; i < size / sizeof *block_buf && cnt < max; i++)
+        {
+          const struct dir_entry *e = &block_buf[i];
+
+          dir->pos += sizeof *e;
+          if (e->in_use)
+            {
+              struct dirent *d = &entries[cnt++];
+              d->inumber = e->inode_sector;
+              d->is_dir = false;        /* No subdirectories yet. */
+              strlcpy (d->name, e->name, sizeof d->name);
+            }
+        }
+    }
+
+ done:
+  lock_release (&dir_lock);
+  return cnt;
+}
+
+/* Appends E to the chain of bucket BUCKET in the indexed
+   directory image *IMAGE, which has *BLOCK_CNT blocks, growing
+   the image if an overflow block is needed.
+   Returns true if successful, false if memory is exhausted. */
+static bool
+image_add (uint8_t **image, uint32_t *block_cnt, uint32_t bucket,
+           const struct dir_entry *e)
+{
+  uint32_t block = bucket;
+
+  for (;;)
+    {
+      struct dir_bucket *b
+        = (struct dir_bucket *) (*image + block * DISK_SECTOR_SIZE);
+      size_t i;
+
+      for (i = 0; i < BUCKET_ENTRY_CNT; i++)
+        if (!b->entries[i].in_use)
+          {
+            b->entries[i] = *e;
+            return true;
+          }
+      if (b->next == 0)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          uint8_t *bigger = realloc (*image,
+                                     (*block_cnt + 1) * DISK_SECTOR_SIZE);
+          if (bigger == NULL)
+            return false;
+          *image = bigger;
+          memset (bigger + *block_cnt * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE);
+          b = (struct dir_bucket *) (bigger + block * DISK_SECTOR_SIZE);
+          b->next = (*block_cnt)++;
+        }
+      block = b->next;
+    }
+}
+
+/* Rewrites DIR in the indexed format, with enough buckets for its
+   current entries at DIR_TARGET_LOAD.  Works for DIR in either
+   format.
+
+   The new directory is written to a scratch inode that is not
+   journaled, so its blocks go straight to disk however many
+   there are, and then swapped in with inode_exchange().  The
+   journal thus only sees a few sectors of inode and free map
+   changes, and a crash leaves either the old directory or the
+   new one.  On failure, DIR is left as it was.
+   Returns true if successful, false on failure. */
+static bool
+rebuild (struct dir *dir)
+{
+  struct dir_entry *entries = NULL;
+  size_t entry_cnt = 0, entry_max = 0;
+  struct dir_bucket *b;
+  struct dir_index *index;
+  struct inode *scratch;
+  disk_sector_t scratch_sector;
+  uint8_t *image = NULL;
+  uint32_t bucket_cnt, block_cnt;
+  off_t ofs, end, size;
+  bool indexed = is_indexed (dir);
+  bool success = false;
+  size_t i;
+
+  /* Collect the entries in use, a block at a time. */
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+  if (indexed)
+    {
+      struct dir_index old;
+      if (!read_index (dir, &old))
+        goto done;
+      ofs = DISK_SECTOR_SIZE;
+      end = (off_t) old.block_cnt * DISK_SECTOR_SIZE;
+    }
+  else
+    {
+      ofs = 0;
+      end = inode_length (dir->inode);
+    }
+  for (; ofs < end; ofs += indexed ? DISK_SECTOR_SIZE : size)
+    {
+      if (!indexed)
+        size = inode_read_at (dir->inode, b->entries, sizeof b->entries, ofs);
+      else if (inode_read_at (dir->inode, b, sizeof *b, ofs) == sizeof *b)
+        size = sizeof b->entries;
+      else
+        goto done;
+      if (size <= 0)
+        break;
+
+      for (i = 0; i < size / sizeof *entries; i++)
+        if (b->entries[i].in_use)
+          {
+            if (entry_cnt == entry_max)
+              {
+                struct dir_entry *bigger;
+                entry_max = entry_max * 2 + BUCKET_ENTRY_CNT;
+                bigger = realloc (entries, entry_max * sizeof *entries);
+                if (bigger == NULL)
+                  goto done;
+                entries = bigger;
+              }
+            entries[entry_cnt++] = b->entries[i];
+          }
+    }
+
+  /* Lay out the new directory in memory. */
+  bucket_cnt = DIV_ROUND_UP (entry_cnt * 100,
+                             BUCKET_ENTRY_CNT * DIR_TARGET_LOAD);
+  if (bucket_cnt < DIR_MIN_BUCKETS)
+    bucket_cnt = DIR_MIN_BUCKETS;
+  block_cnt = 1 + bucket_cnt;
+  image = calloc (block_cnt, DISK_SECTOR_SIZE);
+  if (image == NULL)
+    goto done;
+  for (i = 0; i < entry_cnt; i++)
+    if (!image_add (&image, &block_cnt,
+                    bucket_of (entries[i].name, bucket_cnt), &entries[i]))
+      goto done;
+  index = (struct dir_index *) image;
+  index->bucket_cnt = bucket_cnt;
+  index->block_cnt = block_cnt;
+  index->entry_cnt = entry_cnt;
+
+  /* Write it to a scratch inode.  Removing the scratch inode
+     right away makes closing it release whichever data it ends
+     up with, the new directory's or the old one's. */
+  if (!free_map_allocate (1, &scratch_sector))
+    goto done;
+  if (!inode_create (scratch_sector, 0, 0)
+      || (scratch = inode_open (scratch_sector)) == NULL)
+    {
+      free_map_release (scratch_sector, 1);
+      goto done;
+    }
+  inode_remove (scratch);
+  size = (off_t) block_cnt * DISK_SECTOR_SIZE;
+  if (inode_preallocate (scratch, 0, size)
+      && inode_write_at (scratch, image, size, 0) == size
+      && inode_exchange (dir->inode, scratch))
+    {
+      if (!indexed)
+        inode_set_flags (dir->inode,
+                         inode_get_flags (dir->inode) | INODE_INDEXED);
+      success = true;
     }
-  return false;
+  inode_close (scratch);
+
+ done:
+  free (image);
+  free (entries);
+  free (b);
+  return success;
 }
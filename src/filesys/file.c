@@ -1,7 +1,9 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* An open file. */
 struct file 
@@ -9,6 +11,8 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    int ref_cnt;                /* Number of holders of this file. */
+    struct lock ref_lock;       /* Protects REF_CNT. */
   };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -23,6 +27,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ref_cnt = 1;
+      lock_init (&file->ref_lock);
       return file;
     }
   else
@@ -41,15 +47,38 @@ file_reopen (struct file *file)
   return file_open (inode_reopen (file->inode));
 }
 
-/* Closes FILE. */
+/* Returns FILE with another holder added.  The new holder
+   shares FILE, including its position, with the others, and
+   must close it with file_close() like them.  FILE is closed
+   once all of its holders have closed it. */
+struct file *
+file_dup (struct file *file) 
+{
+  lock_acquire (&file->ref_lock);
+  file->ref_cnt++;
+  lock_release (&file->ref_lock);
+  return file;
+}
+
+/* Closes FILE, or rather releases the caller's hold on it.  See
+   file_dup(). */
 void
 file_close (struct file *file) 
 {
   if (file != NULL)
     {
-      file_allow_write (file);
-      inode_close (file->inode);
-      free (file); 
+      bool last;
+
+      lock_acquire (&file->ref_lock);
+      last = --file->ref_cnt == 0;
+      lock_release (&file->ref_lock);
+
+      if (last)
+        {
+          file_allow_write (file);
+          inode_close (file->inode);
+          free (file); 
+        }
     }
 }
 
@@ -87,10 +116,9 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   Advances FILE's position by the number of bytes read. */
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
+   Advances FILE's position by the number of bytes written. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
@@ -102,9 +130,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -140,6 +167,31 @@ file_allow_write (struct file *file)
     }
 }
 
+/* Allocates disk space for FILE's data up to byte START + SIZE
+   without changing its length, so that later writes there need
+   no allocation and land contiguously on disk.
+   Returns true if successful, false if the disk is full. */
+bool
+file_preallocate (struct file *file, off_t start, off_t size) 
+{
+  ASSERT (file != NULL);
+  return inode_preallocate (file->inode, start, size);
+}
+
+/* Makes sure that FILE's data and all metadata changes so far
+   are on disk.  Returns true if successful, false if the disk is
+   full. */
+bool
+file_sync (struct file *file) 
+{
+  bool success;
+
+  ASSERT (file != NULL);
+  success = inode_flush (file->inode);
+  journal_sync ();
+  return success;
+}
+
 /* Returns the size of FILE in bytes. */
 off_t
 file_length (struct file *file) 
@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 
 /* The disk that contains the file system. */
@@ -23,11 +26,17 @@ filesys_init (bool format)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
   inode_init ();
+  dir_init ();
+  dcache_init ();
+  cache_init ();
+  journal_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  /* Replay the journal before reading any metadata. */
+  journal_open ();
   free_map_open ();
 }
 
@@ -36,7 +45,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_close ();
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,14 +58,19 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   disk_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, 0)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -67,13 +83,9 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
   struct inode *inode = NULL;
 
-  if (dir != NULL)
-    dir_lookup (dir, name, &inode);
-  dir_close (dir);
-
+  dir_lookup_at (ROOT_DIR_SECTOR, name, &inode);
   return file_open (inode);
 }
 
@@ -84,21 +96,79 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
 
+/* Creates a file named NEW_NAME with the same contents as the
+   file named OLD_NAME.  The two files share their data sectors
+   until either one is written, so this takes no data space.
+   Returns true if successful, false otherwise.
+   Fails if no file named OLD_NAME exists, if it is a directory
+   or too large to clone, if a file named NEW_NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_clone (const char *old_name, const char *new_name) 
+{
+  disk_sector_t inode_sector = 0;
+  struct inode *inode = NULL;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && dir_lookup (dir, old_name, &inode)
+             && free_map_allocate (1, &inode_sector)
+             && inode_clone (inode, inode_sector));
+  if (success && !dir_add (dir, new_name, inode_sector)) 
+    {
+      /* Removing the clone releases its sector too. */
+      struct inode *clone = inode_open (inode_sector);
+      if (clone != NULL) 
+        {
+          inode_remove (clone);
+          inode_close (clone);
+          inode_sector = 0;
+        }
+      success = false;
+    }
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  inode_close (inode);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Writes all file data and metadata changes made so far to
+   disk. */
+void
+filesys_sync (void) 
+{
+  inode_flush_all ();
+  journal_sync ();
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
+  journal_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  cache_flush ();
   printf ("done.\n");
 }
@@ -4,9 +4,10 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 
-/* Sectors of system file inodes. */
+/* Sectors of system file inodes and the journal header. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* Journal header sector. */
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
@@ -16,5 +17,7 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_clone (const char *old_name, const char *new_name);
+void filesys_sync (void);
 
 #endif /* filesys/filesys.h */
@@ -1,12 +1,83 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Persistence.
+
+   The free map lives in memory and is written back to its file
+   incrementally: only the sectors of the file whose bits changed
+   are written, tracked in DIRTY.  The file is metadata, so these
+   writes go through the journal along with the changes to the
+   inodes and directories that use the sectors, and reach the
+   disk atomically with them.
+
+   Allocations are written to the file right away, so that they
+   join the same transaction as the operation that needs the new
+   sectors.
+
+   Releases, on the other hand, are deferred while the journal is
+   active.  A released sector must not be reused before the
+   transaction that stopped using it has committed, or a crash
+   could bring back a file whose blocks already hold someone
+   else's data.  A sector whose old contents are still in the
+   journal must even wait for a checkpoint, or replaying the
+   journal would write those contents over its new ones.  The
+   journal calls free_map_release_deferred() after every commit
+   to release whatever has become safe. */
+
+/* Sharing.
+
+   A data sector may belong to more than one file, after
+   free_map_share().  The free map counts the extra owners of
+   each sector in REFS, one byte per sector, kept in the free map
+   file right after the bitmap and written back incrementally the
+   same way.  Releasing a shared sector drops one owner instead
+   of freeing it.  File systems formatted before sharing existed
+   have no room for the counts, so they cannot share sectors. */
+
+/* Free map bits stored per sector of the free map file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+/* Most extra owners a sector may have. */
+#define MAX_REFS UINT8_MAX
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct lock free_map_lock;    /* Protects the variables below. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors promised to writers. */
+static struct bitmap *dirty;         /* Free map file sectors to write. */
+static struct list deferred;         /* Releases waiting for the journal. */
+static uint8_t *refs;                /* Extra owners per sector, or null. */
+static struct bitmap *refs_dirty;    /* REFS sectors to write. */
+
+/* A deferred release. */
+struct deferred_release
+  {
+    struct list_elem elem;           /* Element in DEFERRED. */
+    disk_sector_t sector;            /* First sector. */
+    size_t cnt;                      /* Number of sectors. */
+    unsigned tid;                    /* Transaction that released them. */
+  };
+
+static bool allocate (size_t cnt, disk_sector_t goal, disk_sector_t *,
+                      bool reserved);
+static void release (disk_sector_t, size_t cnt);
+static void release_unshared (disk_sector_t, size_t cnt);
+static void mark_dirty (size_t start, size_t cnt);
+static void mark_refs_dirty (size_t start, size_t cnt);
+static bool write_dirty (void);
+static off_t refs_offset (void);
 
 /* Initializes the free map. */
 void
@@ -17,6 +88,20 @@ free_map_init (void)
     PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                       BITS_PER_SECTOR));
+  if (dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  refs = calloc (bitmap_size (free_map), 1);
+  refs_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                            DISK_SECTOR_SIZE));
+  if (refs == NULL || refs_dirty == NULL)
+    PANIC ("reference count creation failed--disk is too large");
+  list_init (&deferred);
+  lock_init (&free_map_lock);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  reserved_cnt = 0;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -26,26 +111,397 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return allocate (cnt, 0, sectorp, false);
+}
+
+/* Like free_map_allocate(), but prefers the first run of CNT free
+   sectors at or after GOAL, so that data written together lands
+   together on disk.  Falls back to the first run anywhere on the
+   disk. */
+bool
+free_map_allocate_near (size_t cnt, disk_sector_t goal,
+                        disk_sector_t *sectorp) 
+{
+  return allocate (cnt, goal, sectorp, false);
+}
+
+/* Like free_map_allocate_near(), but takes the CNT sectors out of
+   a reservation previously made with free_map_reserve().  If
+   allocation fails, the reservation is kept. */
+bool
+free_map_allocate_reserved (size_t cnt, disk_sector_t goal,
+                            disk_sector_t *sectorp) 
+{
+  return allocate (cnt, goal, sectorp, true);
+}
+
+/* Promises CNT free sectors to the caller without choosing them
+   yet, so that a later free_map_allocate_reserved() for them
+   cannot fail for lack of space.  Returns true if successful,
+   false if fewer than CNT unreserved sectors are free. */
+bool
+free_map_reserve (size_t cnt) 
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved with free_map_reserve() that
+   will not be allocated after all. */
+void
+free_map_unreserve (size_t cnt) 
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Frees the CNT sectors starting at SECTOR, which the caller
+   allocated with free_map_allocate_reserved() but never linked
+   into a file, and puts them back into the caller's reservation.
+   Unlike releasing the sectors and reserving them again, this
+   cannot fail: nothing on disk ever referred to the sectors, so
+   they need not wait for the journal, and no one else can claim
+   them in between. */
+void
+free_map_unallocate (disk_sector_t sector, size_t cnt) 
+{
+  cache_discard (sector, cnt);
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  ASSERT (refs == NULL || refs[sector] == 0);
+  bitmap_set_multiple (free_map, sector, cnt, false);
+  free_cnt += cnt;
+  reserved_cnt += cnt;
+  mark_dirty (sector, cnt);
+  write_dirty ();
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
+/* Adds an owner to each of the CNT allocated sectors starting
+   at SECTOR, which then stay allocated until each owner has
+   released them.  Returns true if successful, false if the file
+   system cannot share sectors or one of them has too many owners
+   already. */
+bool
+free_map_share (disk_sector_t sector, size_t cnt) 
+{
+  bool success = refs != NULL;
+  size_t i;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  for (i = 0; success && i < cnt; i++)
+    success = refs[sector + i] < MAX_REFS;
+  if (success && cnt > 0) 
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      for (i = 0; i < cnt; i++)
+        refs[sector + i]++;
+      mark_refs_dirty (sector, cnt);
+      if (!write_dirty ()) 
+        {
+          for (i = 0; i < cnt; i++)
+            refs[sector + i]--;
+          success = false;
+        }
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Returns the number of free map sectors that sharing the CNT
+   sectors starting at SECTOR changes, which is also the number
+   that releasing them changes once they are shared. */
+size_t
+free_map_share_cost (disk_sector_t sector, size_t cnt) 
+{
+  if (refs == NULL || cnt == 0)
+    return 0;
+  return (sector + cnt - 1) / DISK_SECTOR_SIZE - sector / DISK_SECTOR_SIZE + 1;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns true if SECTOR has more than one owner. */
+bool
+free_map_shared (disk_sector_t sector) 
+{
+  bool shared;
+
+  lock_acquire (&free_map_lock);
+  shared = refs != NULL && refs[sector] > 0;
+  lock_release (&free_map_lock);
+  return shared;
+}
+
+/* Returns the number of sectors, starting at SECTOR and at most
+   CNT, that are shared if SECTOR is and unshared if it is not,
+   and stores which in *SHARED.  Shared sectors lose an owner. */
+static size_t
+drop_owners (disk_sector_t sector, size_t cnt, bool *shared)
+{
+  size_t n;
+
+  *shared = false;
+  if (refs == NULL)
+    return cnt;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  *shared = refs[sector] > 0;
+  for (n = 1; n < cnt && (refs[sector + n] > 0) == *shared; n++)
+    continue;
+  if (*shared) 
+    {
+      size_t i;
+
+      for (i = 0; i < n; i++)
+        refs[sector + i]--;
+      mark_refs_dirty (sector, n);
+      write_dirty ();
+    }
+  lock_release (&free_map_lock);
+  journal_end ();
+  return n;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, as
+   soon as the journal allows.  Shared sectors lose an owner
+   instead. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  while (cnt > 0) 
+    {
+      bool shared;
+      size_t n = drop_owners (sector, cnt, &shared);
+
+      if (!shared)
+        release_unshared (sector, n);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Makes CNT unshared sectors starting at SECTOR available for
+   use, as soon as the journal allows. */
+static void
+release_unshared (disk_sector_t sector, size_t cnt)
+{
+  unsigned tid = journal_running_tid ();
+  struct deferred_release *d;
+
+  /* Without memory to remember them, the sectors are released
+     right away, as they were before the journal existed. */
+  d = tid != 0 ? malloc (sizeof *d) : NULL;
+  if (d == NULL)
+    {
+      release (sector, cnt);
+      return;
+    }
+
+  /* Their contents no longer matter, so keep them out of the
+     journal. */
+  cache_discard (sector, cnt);
+
+  d->sector = sector;
+  d->cnt = cnt;
+  d->tid = tid;
+  lock_acquire (&free_map_lock);
+  ASSERT (bitmap_all (free_map, sector, cnt));
+  list_push_back (&deferred, &d->elem);
+  lock_release (&free_map_lock);
+
+  /* Commit soon so that the space becomes usable. */
+  journal_request_commit ();
+}
+
+/* Carries out the deferred releases that the journal now
+   allows. */
+void
+free_map_release_deferred (void)
+{
+  struct list_elem *e, *next;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  for (e = list_begin (&deferred); e != list_end (&deferred); e = next)
+    {
+      struct deferred_release *d = list_entry (e, struct deferred_release,
+                                               elem);
+      next = list_next (e);
+      if (journal_committed (d->tid) && !journal_logged (d->sector, d->cnt))
+        {
+          list_remove (&d->elem);
+          bitmap_set_multiple (free_map, d->sector, d->cnt, false);
+          free_cnt += d->cnt;
+          mark_dirty (d->sector, d->cnt);
+          free (d);
+        }
+    }
+  write_dirty ();
+  lock_release (&free_map_lock);
+  journal_end ();
+}
+
+/* Writes any changes to the free map back to disk.
+   Returns true if successful, false on error. */
+bool
+free_map_flush (void) 
+{
+  bool success;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  success = write_dirty ();
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates CNT consecutive sectors, searching from GOAL first
+   and then from the start of the disk, and stores the first into
+   *SECTORP.  If RESERVED, the sectors come out of the caller's
+   reservation; otherwise they must not eat into anyone else's. */
+static bool
+allocate (size_t cnt, disk_sector_t goal, disk_sector_t *sectorp,
+          bool reserved) 
+{
+  size_t sector = BITMAP_ERROR;
+
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  if (reserved ? reserved_cnt >= cnt : free_cnt - reserved_cnt >= cnt) 
+    {
+      if (goal < bitmap_size (free_map))
+        sector = bitmap_scan_and_flip (free_map, goal, cnt, false);
+      if (sector == BITMAP_ERROR && goal != 0)
+        sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+    }
+  if (sector != BITMAP_ERROR) 
+    {
+      mark_dirty (sector, cnt);
+      if (!write_dirty ()) 
+        {
+          bitmap_set_multiple (free_map, sector, cnt, false); 
+          sector = BITMAP_ERROR;
+        }
+    }
+  if (sector != BITMAP_ERROR) 
+    {
+      free_cnt -= cnt;
+      if (reserved)
+        reserved_cnt -= cnt;
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
+  journal_end ();
+  return sector != BITMAP_ERROR;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use right
+   away. */
+static void
+release (disk_sector_t sector, size_t cnt)
+{
+  /* Stale cached copies must not be written over whatever the
+     sectors are used for next. */
+  cache_discard (sector, cnt);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_cnt += cnt;
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Notes that the free map bits for the CNT sectors starting at
+   START have changed.  free_map_lock must be held. */
+static void
+mark_dirty (size_t start, size_t cnt) 
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (dirty, first, last - first + 1, true);
+}
+
+/* Notes that the reference counts for the CNT sectors starting
+   at START have changed.  free_map_lock must be held. */
+static void
+mark_refs_dirty (size_t start, size_t cnt) 
+{
+  size_t first = start / DISK_SECTOR_SIZE;
+  size_t last = (start + cnt - 1) / DISK_SECTOR_SIZE;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (refs_dirty, first, last - first + 1, true);
+}
+
+/* Returns the offset of the reference counts in the free map
+   file: the first sector boundary after the bitmap. */
+static off_t
+refs_offset (void) 
+{
+  return ROUND_UP (bitmap_file_size (free_map), DISK_SECTOR_SIZE);
+}
+
+/* Writes the dirty sectors of the free map file and marks them
+   clean.  Does nothing before the file is open, since
+   free_map_create() then writes the whole map.
+   Returns true if successful, false on error, in which case the
+   sectors that could not be written stay dirty.
+   free_map_lock must be held. */
+static bool
+write_dirty (void) 
+{
+  size_t idx = 0;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (free_map_file == NULL)
+    return true;
+
+  while ((idx = bitmap_scan (dirty, idx, 1, true)) != BITMAP_ERROR) 
+    {
+      size_t start = idx * BITS_PER_SECTOR;
+      size_t cnt = bitmap_size (free_map) - start;
+
+      if (cnt > BITS_PER_SECTOR)
+        cnt = BITS_PER_SECTOR;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        return false;
+      bitmap_reset (dirty, idx);
+      idx++;
+    }
+
+  idx = 0;
+  while (refs != NULL
+         && (idx = bitmap_scan (refs_dirty, idx, 1, true)) != BITMAP_ERROR) 
+    {
+      size_t start = idx * DISK_SECTOR_SIZE;
+      size_t cnt = bitmap_size (free_map) - start;
+
+      if (cnt > DISK_SECTOR_SIZE)
+        cnt = DISK_SECTOR_SIZE;
+      if (file_write_at (free_map_file, refs + start, cnt,
+                         refs_offset () + start) != (off_t) cnt)
+        return false;
+      bitmap_reset (refs_dirty, idx);
+      idx++;
+    }
+  return true;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,13 +513,30 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+  bitmap_set_all (dirty, false);
+
+  /* Read the reference counts, if the file has room for them. */
+  if (file_length (free_map_file)
+      < refs_offset () + (off_t) bitmap_size (free_map))
+    {
+      free (refs);
+      refs = NULL;
+    }
+  else if (file_read_at (free_map_file, refs, bitmap_size (free_map),
+                         refs_offset ()) != (off_t) bitmap_size (free_map))
+    PANIC ("can't read free map reference counts");
+  bitmap_set_all (refs_dirty, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  if (!free_map_flush ())
+    printf ("free map: write back failed\n");
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -71,14 +544,20 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  off_t size = refs_offset () + bitmap_size (free_map);
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, size, INODE_JOURNALED))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap and reference counts to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, free_map_file)
+      || file_write_at (free_map_file, refs, bitmap_size (free_map),
+                        refs_offset ()) != (off_t) bitmap_size (free_map))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty, false);
+  bitmap_set_all (refs_dirty, false);
 }
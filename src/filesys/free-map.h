@@ -10,8 +10,19 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+bool free_map_flush (void);
 
 bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_near (size_t, disk_sector_t goal, disk_sector_t *);
+bool free_map_allocate_reserved (size_t, disk_sector_t goal,
+                                 disk_sector_t *);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+void free_map_unallocate (disk_sector_t, size_t);
 void free_map_release (disk_sector_t, size_t);
+bool free_map_share (disk_sector_t, size_t);
+size_t free_map_share_cost (disk_sector_t, size_t);
+bool free_map_shared (disk_sector_t);
+void free_map_release_deferred (void);
 
 #endif /* filesys/free-map.h */
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,8 +8,11 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "devices/disk.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -66,6 +70,121 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* fsutil_put() and fsutil_get() move file data between the
+   scratch disk and the file system in chunks of STAGE_SIZE
+   bytes, each of which takes a single disk command on the
+   scratch disk.  A reader thread fills one staging buffer while
+   the thread doing the put or get drains the other, so that the
+   scratch disk, on the secondary channel, and the file system
+   disk, on the primary channel, are busy at the same time. */
+#define STAGE_PAGES 8
+#define STAGE_SIZE (STAGE_PAGES * PGSIZE)
+
+/* A double-buffered copy between the scratch disk and a file. */
+struct copy
+  {
+    const char *file_name;      /* File being copied, for messages. */
+    off_t size;                 /* Number of bytes to copy. */
+    struct disk *disk;          /* Scratch disk. */
+    disk_sector_t sector;       /* Next sector on the scratch disk. */
+    struct file *file;          /* File in the file system. */
+
+    /* Fills BUFFER with the CHUNK bytes at offset OFS. */
+    void (*fill) (struct copy *, void *buffer, off_t ofs, off_t chunk);
+
+    /* Staging buffers.  EMPTY[i] is up when the reader may fill
+       BUFFERS[i], FULL[i] when the drainer may empty it. */
+    uint8_t *buffers[2];
+    struct semaphore empty[2];
+    struct semaphore full[2];
+  };
+
+/* Reader thread for copy C: fills the staging buffers in turn. */
+static void
+copy_reader (void *c_) 
+{
+  struct copy *c = c_;
+  off_t size = c->size;
+  off_t ofs;
+  int i;
+
+  /* C belongs to the draining thread, which may return as soon
+     as the last buffer is full, so only touch it in between
+     taking EMPTY[i] and raising FULL[i]. */
+  for (ofs = 0, i = 0; ofs < size; ofs += STAGE_SIZE, i = !i) 
+    {
+      off_t chunk = size - ofs < STAGE_SIZE ? size - ofs : STAGE_SIZE;
+      sema_down (&c->empty[i]);
+      c->fill (c, c->buffers[i], ofs, chunk);
+      sema_up (&c->full[i]);
+    }
+}
+
+/* Copies C->size bytes, filling each chunk with C->fill in a
+   separate reader thread and passing it to DRAIN in this one.
+   Prints the throughput achieved. */
+static void
+copy_run (struct copy *c,
+          void (*drain) (struct copy *, const void *, off_t ofs, off_t chunk)) 
+{
+  int64_t start = timer_ticks ();
+  int64_t elapsed;
+  long long rate;
+  off_t ofs;
+  int i;
+
+  for (i = 0; i < 2; i++) 
+    {
+      c->buffers[i] = palloc_get_multiple (PAL_ASSERT, STAGE_PAGES);
+      sema_init (&c->empty[i], 1);
+      sema_init (&c->full[i], 0);
+    }
+
+  if (c->size > 0
+      && thread_create ("fsutil", PRI_DEFAULT, copy_reader, c) == TID_ERROR)
+    PANIC ("%s: couldn't start reader thread", c->file_name);
+  for (ofs = 0, i = 0; ofs < c->size; ofs += STAGE_SIZE, i = !i) 
+    {
+      off_t chunk = c->size - ofs < STAGE_SIZE ? c->size - ofs : STAGE_SIZE;
+      sema_down (&c->full[i]);
+      drain (c, c->buffers[i], ofs, chunk);
+      sema_up (&c->empty[i]);
+    }
+
+  for (i = 0; i < 2; i++)
+    palloc_free_multiple (c->buffers[i], STAGE_PAGES);
+
+  /* Report throughput in hundredths of a MB/s. */
+  elapsed = timer_elapsed (start);
+  if (elapsed < 1)
+    elapsed = 1;
+  rate = (long long) c->size * TIMER_FREQ * 100 / (elapsed * 1024 * 1024);
+  printf ("%s: %"PROTd" bytes in %lld ticks (%lld.%02lld MB/s)\n",
+          c->file_name, c->size, (long long) elapsed,
+          rate / 100, rate % 100);
+}
+
+/* Reads the next chunk of a put from the scratch disk. */
+static void
+put_fill (struct copy *c, void *buffer, off_t ofs UNUSED, off_t chunk) 
+{
+  size_t sectors = DIV_ROUND_UP (chunk, DISK_SECTOR_SIZE);
+
+  if (c->sector + sectors > disk_size (c->disk))
+    PANIC ("%s: scratch disk ends before file", c->file_name);
+  disk_read_multiple (c->disk, c->sector, sectors, buffer);
+  c->sector += sectors;
+}
+
+/* Writes the next chunk of a put to the file. */
+static void
+put_drain (struct copy *c, const void *buffer, off_t ofs, off_t chunk) 
+{
+  if (file_write (c->file, buffer, chunk) != chunk)
+    PANIC ("%s: write failed with %"PROTd" bytes unwritten",
+           c->file_name, c->size - ofs);
+}
+
 /* Copies from the "scratch" disk, hdc or hd1:0 to file ARGV[1]
    in the file system.
 
@@ -84,9 +203,7 @@ fsutil_put (char **argv)
   static disk_sector_t sector = 0;
 
   const char *file_name = argv[1];
-  struct disk *src;
-  struct file *dst;
-  off_t size;
+  struct copy c;
   void *buffer;
 
   printf ("Putting '%s' into the file system...\n", file_name);
@@ -97,39 +214,61 @@ fsutil_put (char **argv)
     PANIC ("couldn't allocate buffer");
 
   /* Open source disk and read file size. */
-  src = disk_get (1, 0);
-  if (src == NULL)
+  c.file_name = file_name;
+  c.disk = disk_get (1, 0);
+  if (c.disk == NULL)
     PANIC ("couldn't open source disk (hdc or hd1:0)");
 
   /* Read file size. */
-  disk_read (src, sector++, buffer);
+  disk_read (c.disk, sector++, buffer);
   if (memcmp (buffer, "PUT", 4))
     PANIC ("%s: missing PUT signature on scratch disk", file_name);
-  size = ((int32_t *) buffer)[1];
-  if (size < 0)
-    PANIC ("%s: invalid file size %d", file_name, size);
+  c.size = ((int32_t *) buffer)[1];
+  if (c.size < 0)
+    PANIC ("%s: invalid file size %d", file_name, c.size);
+  free (buffer);
   
   /* Create destination file. */
-  if (!filesys_create (file_name, size))
+  if (!filesys_create (file_name, c.size))
     PANIC ("%s: create failed", file_name);
-  dst = filesys_open (file_name);
-  if (dst == NULL)
+  c.file = filesys_open (file_name);
+  if (c.file == NULL)
     PANIC ("%s: open failed", file_name);
 
   /* Do copy. */
-  while (size > 0)
-    {
-      int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-      disk_read (src, sector++, buffer);
-      if (file_write (dst, buffer, chunk_size) != chunk_size)
-        PANIC ("%s: write failed with %"PROTd" bytes unwritten",
-               file_name, size);
-      size -= chunk_size;
-    }
+  c.sector = sector;
+  c.fill = put_fill;
+  copy_run (&c, put_drain);
+  sector = c.sector;
 
   /* Finish up. */
-  file_close (dst);
-  free (buffer);
+  file_close (c.file);
+}
+
+/* Reads the next chunk of a get from the file, padding it with
+   zeros to a whole number of sectors. */
+static void
+get_fill (struct copy *c, void *buffer, off_t ofs, off_t chunk) 
+{
+  off_t padded = ROUND_UP (chunk, DISK_SECTOR_SIZE);
+
+  if (file_read (c->file, buffer, chunk) != chunk)
+    PANIC ("%s: read failed with %"PROTd" bytes unread",
+           c->file_name, c->size - ofs);
+  memset ((uint8_t *) buffer + chunk, 0, padded - chunk);
+}
+
+/* Writes the next chunk of a get to the scratch disk. */
+static void
+get_drain (struct copy *c, const void *buffer, off_t ofs UNUSED,
+           off_t chunk) 
+{
+  size_t sectors = DIV_ROUND_UP (chunk, DISK_SECTOR_SIZE);
+
+  if (c->sector + sectors > disk_size (c->disk))
+    PANIC ("%s: out of space on scratch disk", c->file_name);
+  disk_write_multiple (c->disk, c->sector, sectors, buffer);
+  c->sector += sectors;
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -149,10 +288,8 @@ fsutil_get (char **argv)
   static disk_sector_t sector = 0;
 
   const char *file_name = argv[1];
+  struct copy c;
   void *buffer;
-  struct file *src;
-  struct disk *dst;
-  off_t size;
 
   printf ("Getting '%s' from the file system...\n", file_name);
 
@@ -162,36 +299,30 @@ fsutil_get (char **argv)
     PANIC ("couldn't allocate buffer");
 
   /* Open source file. */
-  src = filesys_open (file_name);
-  if (src == NULL)
+  c.file_name = file_name;
+  c.file = filesys_open (file_name);
+  if (c.file == NULL)
     PANIC ("%s: open failed", file_name);
-  size = file_length (src);
+  c.size = file_length (c.file);
 
   /* Open target disk. */
-  dst = disk_get (1, 0);
-  if (dst == NULL)
+  c.disk = disk_get (1, 0);
+  if (c.disk == NULL)
     PANIC ("couldn't open target disk (hdc or hd1:0)");
   
   /* Write size to sector 0. */
   memset (buffer, 0, DISK_SECTOR_SIZE);
   memcpy (buffer, "GET", 4);
-  ((int32_t *) buffer)[1] = size;
-  disk_write (dst, sector++, buffer);
+  ((int32_t *) buffer)[1] = c.size;
+  disk_write (c.disk, sector++, buffer);
+  free (buffer);
   
   /* Do copy. */
-  while (size > 0) 
-    {
-      int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-      if (sector >= disk_size (dst))
-        PANIC ("%s: out of space on scratch disk", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
-        PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, DISK_SECTOR_SIZE - chunk_size);
-      disk_write (dst, sector++, buffer);
-      size -= chunk_size;
-    }
+  c.sector = sector;
+  c.fill = get_fill;
+  copy_run (&c, get_drain);
+  sector = c.sector;
 
   /* Finish up. */
-  file_close (src);
-  free (buffer);
+  file_close (c.file);
 }
@@ -1,25 +1,93 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of consecutive disk sectors that holds consecutive
+   sector-sized blocks of a file. */
+struct extent
+  {
+    uint32_t block;                     /* First file block. */
+    disk_sector_t start;                /* First disk sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Number of extents in the inode itself, in its indirect extent
+   block, and in total. */
+#define DIRECT_EXTENT_CNT 40
+#define INDIRECT_EXTENT_CNT 42
+#define MAX_EXTENT_CNT (DIRECT_EXTENT_CNT + INDIRECT_EXTENT_CNT)
+
 /* On-disk inode.
-   Must be exactly DISK_SECTOR_SIZE bytes long. */
+   Must be exactly DISK_SECTOR_SIZE bytes long.
+
+   A file's data is described by up to MAX_EXTENT_CNT extents,
+   sorted by block number.  The first DIRECT_EXTENT_CNT live here,
+   the rest in the indirect extent block. */
 struct inode_disk
   {
-    disk_sector_t start;                /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    disk_sector_t indirect;             /* Indirect extent block, or 0. */
+    struct extent extents[DIRECT_EXTENT_CNT]; /* Direct extents. */
+    uint32_t flags;                     /* INODE_* flags. */
+    uint32_t unused[3];                 /* Not used. */
   };
 
+/* On-disk indirect extent block.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct inode_indirect
+  {
+    struct extent extents[INDIRECT_EXTENT_CNT]; /* More extents. */
+    uint32_t unused[2];                 /* Not used. */
+  };
+
+/* Delayed allocation.
+
+   Blocks written past the end of a file's allocated sectors are
+   not given sectors right away.  Instead they collect in a
+   per-inode buffer, and sectors are chosen for all of them at
+   once when the buffer fills up or the inode is closed.  Small
+   appends then cost no disk I/O at all, and the blocks they make
+   up end up in a few long extents written by multi-sector
+   transfers, rather than one sector at a time wherever the free
+   map happened to have room.
+
+   Space for buffered blocks is reserved in the free map as they
+   are buffered, so that running out of disk is reported by the
+   write that causes it rather than lost at flush time. */
+
+/* Most blocks buffered per inode. */
+#define DELALLOC_BLOCKS 64
+
+/* Once an inode uses this many extents, further blocks are
+   allocated as they are written, so that a flush cannot fail for
+   lack of extents where no caller would see the error. */
+#define DELALLOC_MAX_EXTENTS (MAX_EXTENT_CNT - 8)
+
+/* Once an inode uses this many extents, a write into a hole
+   fills all of the file's holes with zeros, making it dense. */
+#define SPARSE_MAX_EXTENTS (MAX_EXTENT_CNT / 2)
+
+/* Most free map sectors that cloning a file may change.  A clone
+   is one journal operation, and so is removing a file whose
+   sectors are shared, so either must fit in a transaction with
+   room to spare for others.  This limits clones to files of
+   about 4 MB. */
+#define CLONE_MAX_SECTORS 16
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -31,77 +99,943 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in inode table. */
+    struct list_elem lru_elem;          /* Element in closed_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /* Protects length, extents
+                                           and pending blocks. */
+    struct lock extend_lock;            /* Serializes writes past EOF. */
+    int writer_cnt;                     /* Sector writes in progress. */
+    struct condition writers_done;      /* Signaled when WRITER_CNT is 0. */
     struct inode_disk data;             /* Inode content. */
+    struct inode_indirect *indirect;    /* Indirect extents, if any. */
+
+    /* Delayed allocation: blocks allocated_blocks() through
+       allocated_blocks() + PENDING_CNT - 1, not yet on disk. */
+    uint8_t *pending;                   /* DELALLOC_BLOCKS blocks, or null. */
+    size_t pending_cnt;                 /* Number of pending blocks. */
   };
 
-/* Returns the disk sector that contains byte offset POS within
-   INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+/* Returns extent number IDX of INODE. */
+static struct extent *
+extent_at (const struct inode *inode, size_t idx) 
+{
+  ASSERT (idx < inode->data.extent_cnt);
+  if (idx < DIRECT_EXTENT_CNT)
+    return (struct extent *) &inode->data.extents[idx];
+  else
+    return &inode->indirect->extents[idx - DIRECT_EXTENT_CNT];
+}
+
+/* Returns one more than the last block of INODE that has a disk
+   sector allocated, or 0 if none does.  Blocks before it that
+   are in no extent are holes, which read as zeros. */
+static size_t
+allocated_blocks (const struct inode *inode) 
+{
+  const struct extent *last;
+
+  if (inode->data.extent_cnt == 0)
+    return 0;
+  last = extent_at (inode, inode->data.extent_cnt - 1);
+  return last->block + last->cnt;
+}
+
+/* Returns the index of the first of INODE's extents that ends
+   after block BLOCK, or INODE's extent count if there is none.
+   Binary searches the extents, so this takes O(log n) time in
+   the number of extents. */
+static size_t
+find_extent (const struct inode *inode, size_t block) 
+{
+  size_t lo = 0, hi = inode->data.extent_cnt;
+
+  while (lo < hi) 
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      const struct extent *e = extent_at (inode, mid);
+      if (block < e->block + e->cnt)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return lo;
+}
+
+/* Returns the disk sector that holds block BLOCK of INODE, or -1
+   if BLOCK is a hole.  If RUN is nonnull, stores in *RUN the
+   number of blocks, starting at BLOCK, that follow it
+   contiguously on disk, or for a hole the number of blocks
+   before the next allocated one (SIZE_MAX if there is none). */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+lookup_block (const struct inode *inode, size_t block, size_t *run) 
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / DISK_SECTOR_SIZE;
+  size_t idx = find_extent (inode, block);
+  size_t dummy;
+
+  if (run == NULL)
+    run = &dummy;
+  if (idx < inode->data.extent_cnt) 
+    {
+      const struct extent *e = extent_at (inode, idx);
+      if (block >= e->block) 
+        {
+          *run = e->block + e->cnt - block;
+          return e->start + (block - e->block);
+        }
+      *run = e->block - block;
+    }
+  else
+    *run = SIZE_MAX;
+  return -1;
+}
+
+/* Returns the sector at which to look for free sectors for
+   INODE's next blocks: just past its last extent, so that the
+   file stays contiguous, or just past the inode itself for an
+   empty file. */
+static disk_sector_t
+next_goal (const struct inode *inode) 
+{
+  const struct extent *last;
+
+  if (inode->data.extent_cnt == 0)
+    return inode->sector + 1;
+  last = extent_at (inode, inode->data.extent_cnt - 1);
+  return last->start + last->cnt;
+}
+
+/* Writes INODE's on-disk inode and indirect extent block back to
+   disk. */
+static void
+write_inode (struct inode *inode) 
+{
+  cache_write (inode->sector, &inode->data);
+  if (inode->indirect != NULL)
+    cache_write (inode->data.indirect, inode->indirect);
+}
+
+/* Returns true if INODE's contents are metadata, which go
+   through the buffer cache and the journal like the inode
+   itself.  Other file data goes straight to disk. */
+static bool
+is_journaled (const struct inode *inode) 
+{
+  return (inode->data.flags & INODE_JOURNALED) != 0;
+}
+
+/* Reads data sector SECTOR of INODE into BUFFER. */
+static void
+read_sector (const struct inode *inode, disk_sector_t sector, void *buffer) 
+{
+  if (is_journaled (inode))
+    cache_read (sector, buffer);
+  else
+    disk_read (filesys_disk, sector, buffer);
+}
+
+/* Writes BUFFER to data sector SECTOR of INODE. */
+static void
+write_sector (const struct inode *inode, disk_sector_t sector,
+              const void *buffer) 
+{
+  if (is_journaled (inode))
+    cache_write (sector, buffer);
+  else
+    disk_write (filesys_disk, sector, buffer);
+}
+
+/* Inserts an extent that maps the CNT blocks starting at BLOCK
+   to the CNT sectors starting at START into INODE as its extent
+   number IDX, merging it into its neighbors where they are
+   contiguous with it both in the file and on disk.
+   Returns true if successful, false if INODE has no room for
+   another extent or memory or disk allocation fails. */
+static bool
+insert_extent (struct inode *inode, size_t idx, size_t block,
+               disk_sector_t start, size_t cnt) 
+{
+  struct extent *prev = idx > 0 ? extent_at (inode, idx - 1) : NULL;
+  struct extent *next = (idx < inode->data.extent_cnt
+                         ? extent_at (inode, idx) : NULL);
+  bool join_prev = (prev != NULL && prev->block + prev->cnt == block
+                    && prev->start + prev->cnt == start);
+  bool join_next = (next != NULL && block + cnt == next->block
+                    && start + cnt == next->start);
+  struct extent *e;
+  size_t i;
+
+  if (join_prev && join_next) 
+    {
+      /* The new sectors fill the hole between PREV and NEXT. */
+      prev->cnt += cnt + next->cnt;
+      for (i = idx; i + 1 < inode->data.extent_cnt; i++)
+        *extent_at (inode, i) = *extent_at (inode, i + 1);
+      inode->data.extent_cnt--;
+      return true;
+    }
+  else if (join_prev) 
+    {
+      prev->cnt += cnt;
+      return true;
+    }
+  else if (join_next) 
+    {
+      next->block = block;
+      next->start = start;
+      next->cnt += cnt;
+      return true;
+    }
+
+  if (inode->data.extent_cnt >= MAX_EXTENT_CNT)
+    return false;
+  if (inode->data.extent_cnt == DIRECT_EXTENT_CNT && inode->indirect == NULL)
+    {
+      inode->indirect = calloc (1, sizeof *inode->indirect);
+      if (inode->indirect == NULL)
+        return false;
+      if (!free_map_allocate (1, &inode->data.indirect)) 
+        {
+          free (inode->indirect);
+          inode->indirect = NULL;
+          return false;
+        }
+    }
+
+  inode->data.extent_cnt++;
+  for (i = inode->data.extent_cnt - 1; i > idx; i--)
+    *extent_at (inode, i) = *extent_at (inode, i - 1);
+  e = extent_at (inode, idx);
+  e->block = block;
+  e->start = start;
+  e->cnt = cnt;
+  return true;
+}
+
+/* Appends an extent that maps the CNT blocks starting at BLOCK,
+   which must be past INODE's last allocated block, to the CNT
+   sectors starting at START.
+   Returns true if successful, false if INODE has no room for
+   another extent or memory or disk allocation fails. */
+static bool
+append_extent_at (struct inode *inode, size_t block, disk_sector_t start,
+                  size_t cnt) 
+{
+  ASSERT (block >= allocated_blocks (inode));
+  return insert_extent (inode, inode->data.extent_cnt, block, start, cnt);
+}
+
+/* Appends CNT sectors starting at START to INODE as its next
+   blocks, just past its last allocated block.
+   Returns true if successful, false if INODE has no room for
+   another extent or memory or disk allocation fails. */
+static bool
+append_extent (struct inode *inode, disk_sector_t start, size_t cnt) 
+{
+  return append_extent_at (inode, allocated_blocks (inode), start, cnt);
+}
+
+/* Gives INODE's pending blocks sectors, near the end of its
+   last extent if possible, and writes them out with as few
+   transfers as possible.
+   Returns true if successful, false if extents run out or the
+   free map cannot be written, in which case the blocks that could
+   not be placed stay pending.
+   INODE's lock must be held. */
+static bool
+flush_pending (struct inode *inode) 
+{
+  size_t done = 0;
+  bool success = true;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  while (done < inode->pending_cnt) 
+    {
+      size_t cnt = inode->pending_cnt - done;
+      disk_sector_t start;
+
+      while (cnt > 0
+             && !free_map_allocate_reserved (cnt, next_goal (inode), &start))
+        cnt /= 2;
+      if (cnt == 0) 
+        {
+          success = false;
+          break;
+        }
+      disk_write_multiple (filesys_disk, start, cnt,
+                           inode->pending + done * DISK_SECTOR_SIZE);
+      if (!append_extent (inode, start, cnt)) 
+        {
+          /* Put the sectors back into our reservation, which the
+             blocks still pending keep needing. */
+          free_map_unallocate (start, cnt);
+          success = false;
+          break;
+        }
+      done += cnt;
+    }
+
+  if (done > 0) 
+    {
+      inode->pending_cnt -= done;
+      memmove (inode->pending, inode->pending + done * DISK_SECTOR_SIZE,
+               inode->pending_cnt * DISK_SECTOR_SIZE);
+      write_inode (inode);
+    }
+  if (inode->pending_cnt == 0) 
+    {
+      free (inode->pending);
+      inode->pending = NULL;
+    }
+  return success;
+}
+
+/* Throws away INODE's pending blocks and their reservation.
+   INODE's lock must be held. */
+static void
+discard_pending (struct inode *inode) 
+{
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  free_map_unreserve (inode->pending_cnt);
+  inode->pending_cnt = 0;
+  free (inode->pending);
+  inode->pending = NULL;
+}
+
+/* Tries to store SIZE bytes from SRC, or zeros if SRC is null, at
+   offset OFS within block BLOCK of INODE in INODE's pending
+   blocks.  BLOCK must not have a sector allocated.
+   Returns true if successful, false if BLOCK must be allocated
+   right away instead.
+   INODE's lock must be held. */
+static bool
+buffer_block (struct inode *inode, size_t block, int ofs,
+              const uint8_t *src, int size) 
+{
+  size_t idx = block - allocated_blocks (inode);
+  uint8_t *dst;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  ASSERT (block >= allocated_blocks (inode));
+
+  if (idx > inode->pending_cnt
+      || inode->data.extent_cnt >= DELALLOC_MAX_EXTENTS
+      || is_journaled (inode))
+    return false;
+  if (idx == DELALLOC_BLOCKS) 
+    {
+      /* Buffer full.  Flushing it makes BLOCK the first pending
+         block. */
+      if (!flush_pending (inode))
+        return false;
+      idx = 0;
+    }
+
+  if (inode->pending == NULL) 
+    {
+      inode->pending = malloc (DELALLOC_BLOCKS * DISK_SECTOR_SIZE);
+      if (inode->pending == NULL)
+        return false;
+    }
+  if (idx == inode->pending_cnt) 
+    {
+      if (!free_map_reserve (1))
+        return false;
+      memset (inode->pending + idx * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE);
+      inode->pending_cnt++;
+    }
+
+  dst = inode->pending + idx * DISK_SECTOR_SIZE + ofs;
+  if (src != NULL)
+    memcpy (dst, src, size);
   else
-    return -1;
+    memset (dst, 0, size);
+  return true;
+}
+
+/* Returns the sector at which to look for free sectors for hole
+   block BLOCK of INODE, which lies just before extent IDX: the
+   sector the block would have if the hole were filled in one
+   piece, so that filling the rest of it later merges the extents
+   on either side. */
+static disk_sector_t
+hole_goal (const struct inode *inode, size_t idx, size_t block) 
+{
+  if (idx > 0) 
+    {
+      const struct extent *prev = extent_at (inode, idx - 1);
+      return prev->start + (block - prev->block);
+    }
+  else if (idx < inode->data.extent_cnt) 
+    {
+      const struct extent *next = extent_at (inode, idx);
+      if (next->start > next->block - block)
+        return next->start - (next->block - block);
+    }
+  return inode->sector + 1 + block;
+}
+
+/* Allocates sectors for the CNT blocks of INODE starting at
+   BLOCK, which must all lie in one hole or past INODE's last
+   allocated block, taking the longest runs it can find where
+   they line up with the blocks around them.  The new blocks
+   that lie before end of file, except block KEEP, are zeroed,
+   since they used to read as zeros.  Does not write INODE back
+   to disk.
+   Returns true if successful, false if disk space or extents run
+   out.
+   INODE's lock must be held and it must have no pending blocks. */
+static bool
+fill_hole (struct inode *inode, size_t block, size_t cnt, size_t keep) 
+{
+  static const uint8_t zeros[DISK_SECTOR_SIZE];
+  size_t eof_blocks = bytes_to_sectors (inode->data.length);
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  ASSERT (inode->pending_cnt == 0);
+
+  while (cnt > 0) 
+    {
+      size_t idx = find_extent (inode, block);
+      size_t n = cnt;
+      size_t i;
+      disk_sector_t goal, start;
+
+      goal = hole_goal (inode, idx, block);
+      while (n > 0 && !free_map_allocate_near (n, goal, &start))
+        n /= 2;
+      if (n == 0)
+        return false;
+      if (!insert_extent (inode, idx, block, start, n)) 
+        {
+          free_map_release (start, n);
+          return false;
+        }
+      for (i = 0; i < n && block + i < eof_blocks; i++)
+        if (block + i != keep)
+          write_sector (inode, start + i, zeros);
+      block += n;
+      cnt -= n;
+    }
+  return true;
+}
+
+/* Makes sure that INODE has sectors allocated for blocks FIRST
+   up to but not including LAST, filling any holes in that range
+   as fill_hole() does.  Any pending blocks are flushed first.
+   Returns true if successful, false if disk space or extents run
+   out.
+   INODE's lock must be held. */
+static bool
+grow (struct inode *inode, size_t first, size_t last, size_t keep) 
+{
+  size_t block = first;
+  bool success = true;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (inode->pending_cnt > 0 && !flush_pending (inode))
+    return false;
+
+  while (block < last) 
+    {
+      size_t run;
+
+      if (lookup_block (inode, block, &run) == (disk_sector_t) -1) 
+        {
+          if (run > last - block)
+            run = last - block;
+          if (!fill_hole (inode, block, run, keep)) 
+            {
+              success = false;
+              break;
+            }
+        }
+      block += run;
+    }
+  write_inode (inode);
+  return success;
+}
+
+/* Allocates a sector for block BLOCK of INODE, which must be a
+   hole or one of INODE's pending blocks, for the caller to write.
+   Once INODE is short of extents, all of its holes are filled
+   instead, since a file written in random order would otherwise
+   run out of them.
+   Returns true if successful, false if disk space or extents run
+   out.
+   INODE's lock must be held. */
+static bool
+fill_block (struct inode *inode, size_t block) 
+{
+  size_t eof_blocks = bytes_to_sectors (inode->data.length);
+
+  if (inode->data.extent_cnt >= SPARSE_MAX_EXTENTS
+      && grow (inode, 0, block < eof_blocks ? eof_blocks : block + 1, block))
+    return true;
+  return grow (inode, block, block + 1, block);
+}
+
+/* Turns block BLOCK of INODE back into a hole, splitting its
+   extent if necessary.
+   Returns true if successful, false if splitting the extent
+   needs an extent that is not available.
+   INODE's lock must be held and it must have no pending blocks. */
+static bool
+punch_block (struct inode *inode, size_t block) 
+{
+  size_t idx = find_extent (inode, block);
+  struct extent *e = extent_at (inode, idx);
+  size_t i;
+
+  ASSERT (inode->pending_cnt == 0);
+  ASSERT (block >= e->block && block < e->block + e->cnt);
+
+  if (e->cnt == 1) 
+    {
+      for (i = idx; i + 1 < inode->data.extent_cnt; i++)
+        *extent_at (inode, i) = *extent_at (inode, i + 1);
+      inode->data.extent_cnt--;
+    }
+  else if (block == e->block) 
+    {
+      e->block++;
+      e->start++;
+      e->cnt--;
+    }
+  else if (block == e->block + e->cnt - 1)
+    e->cnt--;
+  else 
+    {
+      /* Shrink E to the blocks before BLOCK, then add the blocks
+         after it as an extent of their own. */
+      size_t old_cnt = e->cnt;
+      size_t before = block - e->block;
+      disk_sector_t after_start = e->start + before + 1;
+
+      e->cnt = before;
+      if (!insert_extent (inode, idx + 1, block + 1, after_start,
+                          old_cnt - before - 1)) 
+        {
+          extent_at (inode, idx)->cnt = old_cnt;
+          return false;
+        }
+    }
+  return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Gives block BLOCK of INODE, whose sector is shared with another
+   file, a sector of its own, for the caller to write.  Stores the
+   old sector into *OLD.  INODE still owns it: the caller must read
+   whatever it needs from it and then release it.
+   Returns true if successful, false if disk space or extents run
+   out, in which case nothing changes.
+   INODE's lock must be held. */
+static bool
+unshare_block (struct inode *inode, size_t block, disk_sector_t *old) 
+{
+  if (inode->pending_cnt > 0 && !flush_pending (inode))
+    return false;
+
+  *old = lookup_block (inode, block, NULL);
+  if (!punch_block (inode, block))
+    return false;
+  if (!fill_hole (inode, block, 1, block)) 
+    {
+      /* Put the old sector back.  It fits where it came from, so
+         this cannot fail. */
+      bool success = insert_extent (inode, find_extent (inode, block),
+                                    block, *old, 1);
+      ASSERT (success);
+      return false;
+    }
+  write_inode (inode);
+  return true;
+}
+
+/* Copies the blocks of INODE's extent that holds block BLOCK, at
+   least one of which is shared with another file, to sectors of
+   INODE's own, so that its blocks can be written without adding
+   extents.
+   Returns true if successful, false if disk space or memory runs
+   out, in which case nothing changes.
+   INODE's lock must be held. */
+static bool
+unshare_extent (struct inode *inode, size_t block) 
+{
+  enum { COPY_SECTORS = 16 };
+  struct extent *e = extent_at (inode, find_extent (inode, block));
+  disk_sector_t start;
+  uint8_t *buffer;
+  size_t i;
+
+  buffer = malloc (COPY_SECTORS * DISK_SECTOR_SIZE);
+  if (buffer == NULL)
+    return false;
+  if (!free_map_allocate_near (e->cnt, e->start + e->cnt, &start)) 
+    {
+      free (buffer);
+      return false;
+    }
+  for (i = 0; i < e->cnt; i += COPY_SECTORS) 
+    {
+      size_t n = e->cnt - i < COPY_SECTORS ? e->cnt - i : COPY_SECTORS;
+      disk_read_multiple (filesys_disk, e->start + i, n, buffer);
+      disk_write_multiple (filesys_disk, start + i, n, buffer);
+    }
+  free (buffer);
+
+  free_map_release (e->start, e->cnt);
+  e->start = start;
+  write_inode (inode);
+  return true;
+}
+
+/* Writes SIZE bytes from SRC, or zeros if SRC is null, into
+   INODE starting at OFFSET, allocating sectors for holes or
+   buffering blocks past the allocated ones as needed.  Zeros are
+   not written to holes, which read as zeros anyway.  Bytes at or
+   past OLD_LENGTH, the file's length before this write, are taken
+   to be garbage: they are not read back before being partially
+   overwritten.
+
+   Each block's metadata changes are a journal operation of their
+   own.  When the block gets a new sector, the operation lasts
+   until the sector has been written, so that a crash never
+   leaves the file pointing to a sector's old contents; otherwise
+   it ends before the data is written.
+   Returns the number of bytes written. */
+static off_t
+write_blocks (struct inode *inode, const uint8_t *src, off_t offset,
+              off_t size, off_t old_length) 
+{
+  static const uint8_t zeros[DISK_SECTOR_SIZE];
+  off_t bytes_written = 0;
+  uint8_t *bounce = NULL;
+
+  while (size > 0) 
+    {
+      /* Block to write, starting byte offset within block. */
+      size_t block = offset / DISK_SECTOR_SIZE;
+      int sector_ofs = offset % DISK_SECTOR_SIZE;
+      const uint8_t *chunk = src != NULL ? src + bytes_written : NULL;
+      disk_sector_t sector_idx;
+      disk_sector_t old_sector = -1;
+      bool fresh = false;
+      bool allocated = false;
+
+      /* Bytes left in sector. */
+      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
+
+      /* Number of bytes to actually write into this sector. */
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      /* A partial sector needs a bounce buffer.  Get it before
+         allocating a sector, which must then be written. */
+      if (chunk_size < DISK_SECTOR_SIZE && bounce == NULL) 
+        {
+          bounce = malloc (DISK_SECTOR_SIZE);
+          if (bounce == NULL)
+            break;
+        }
+
+      journal_begin ();
+      lock_acquire (&inode->lock);
+      sector_idx = lookup_block (inode, block, NULL);
+      if (sector_idx == (disk_sector_t) -1) 
+        {
+          size_t first_pending = allocated_blocks (inode);
+          bool pending = (block >= first_pending
+                          && block - first_pending < inode->pending_cnt);
+
+          if ((chunk == NULL && !pending)
+              || (block >= first_pending
+                  && buffer_block (inode, block, sector_ofs,
+                                   chunk, chunk_size))) 
+            {
+              lock_release (&inode->lock);
+              journal_end ();
+              goto advance;
+            }
+          if (!fill_block (inode, block)) 
+            {
+              lock_release (&inode->lock);
+              journal_end ();
+              break;
+            }
+          sector_idx = lookup_block (inode, block, NULL);
+          allocated = true;
+
+          /* A sector newly allocated for a hole holds garbage,
+             not the zeros the hole read as. */
+          fresh = !pending;
+        }
+      else if (!is_journaled (inode) && free_map_shared (sector_idx)) 
+        {
+          /* Copy on write.  Once INODE is short of extents, copy
+             the whole extent rather than splitting it. */
+          bool success;
+
+          if (inode->data.extent_cnt >= SPARSE_MAX_EXTENTS)
+            success = unshare_extent (inode, block);
+          else
+            success = unshare_block (inode, block, &old_sector);
+          if (!success) 
+            {
+              lock_release (&inode->lock);
+              journal_end ();
+              break;
+            }
+          sector_idx = lookup_block (inode, block, NULL);
+          allocated = true;
+        }
+
+      /* Until the sector is written, inode_clone() must not share
+         it, or this write would change the clone too. */
+      inode->writer_cnt++;
+      lock_release (&inode->lock);
+      if (!allocated)
+        journal_end ();
+
+      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+        {
+          /* Write full sector directly to disk. */
+          write_sector (inode, sector_idx, chunk != NULL ? chunk : zeros);
+        }
+      else 
+        {
+          /* If the sector contains data before or after the chunk
+             we're writing, read it in first. */
+          if (!fresh && (off_t) block * DISK_SECTOR_SIZE < old_length)
+            read_sector (inode, (old_sector != (disk_sector_t) -1
+                                 ? old_sector : sector_idx), bounce);
+          else
+            memset (bounce, 0, DISK_SECTOR_SIZE);
+          memcpy (bounce + sector_ofs, chunk != NULL ? chunk : zeros,
+                  chunk_size);
+          write_sector (inode, sector_idx, bounce);
+        }
+      lock_acquire (&inode->lock);
+      if (--inode->writer_cnt == 0)
+        cond_broadcast (&inode->writers_done, &inode->lock);
+      lock_release (&inode->lock);
+      if (old_sector != (disk_sector_t) -1)
+        free_map_release (old_sector, 1);
+      if (allocated)
+        journal_end ();
+
+    advance:
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_written += chunk_size;
+    }
+  free (bounce);
+
+  return bytes_written;
+}
+
+/* Releases all of INODE's data sectors and its indirect extent
+   block to the free map. */
+static void
+deallocate (struct inode *inode) 
+{
+  size_t i;
+
+  for (i = 0; i < inode->data.extent_cnt; i++) 
+    {
+      struct extent *e = extent_at (inode, i);
+      free_map_release (e->start, e->cnt);
+    }
+  if (inode->indirect != NULL)
+    free_map_release (inode->data.indirect, 1);
+}
+
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.
+
+   Besides the open inodes, the table keeps up to
+   inode_cache_size recently closed ones, so that reopening a
+   file that was just closed, as happens all the time with
+   directories and executables, needs no disk access.  Closed
+   inodes are always clean: their pending blocks are flushed
+   before they enter the cache.  They sit on CLOSED_INODES in
+   least-recently-closed order and are evicted from its front.
+
+   INODE_TABLE_LOCK protects the table, the cache, and every
+   inode's OPEN_CNT.  It is never held across disk I/O. */
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;
+static struct lock inode_table_lock;
+
+/* Maximum number of closed inodes to keep in memory.
+   Set with the -icache kernel option. */
+size_t inode_cache_size = 64;
+
+static unsigned inode_hash (const struct hash_elem *, void *aux);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
+static struct inode *lookup_inode (disk_sector_t);
+static void forget_inode (disk_sector_t);
+static void free_inode (struct inode *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&inode_table, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&inode_table_lock);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   disk.
+/* Initializes an inode with LENGTH bytes of data and the given
+   INODE_* FLAGS and writes the new inode to sector SECTOR on the
+   file system disk.
+
+   A regular file's data starts out as a single hole, so creating
+   one takes constant time however long it is.  A journaled
+   inode's data is allocated and zeroed up front instead, so that
+   writing metadata, and the free map in particular, never has to
+   allocate sectors.
+
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length)
+inode_create (disk_sector_t sector, off_t length, unsigned flags)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode *inode;
+  bool success;
 
   ASSERT (length >= 0);
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
+  /* If these assertions fail, the inode structures are not
+     exactly one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct inode_indirect) == DISK_SECTOR_SIZE);
 
+  /* Write an empty inode, first dropping any stale copy of an
+     earlier inode at SECTOR from the cache. */
+  forget_inode (sector);
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->flags = flags;
+  if ((flags & INODE_JOURNALED) == 0)
+    disk_inode->length = length;
+  journal_begin ();
+  cache_write (sector, disk_inode);
+  free (disk_inode);
+  if (length == 0 || (flags & INODE_JOURNALED) == 0)
+    {
+      journal_end ();
+      return true;
+    }
+
+  /* Then allocate LENGTH bytes and fill them with zeros. */
+  inode = inode_open (sector);
+  if (inode == NULL)
+    {
+      journal_end ();
+      return false;
+    }
+  lock_acquire (&inode->lock);
+  success = grow (inode, 0, bytes_to_sectors (length), SIZE_MAX);
+  lock_release (&inode->lock);
+  if (success)
+    success = write_blocks (inode, NULL, 0, length, 0) == length;
+  lock_acquire (&inode->lock);
+  if (success) 
+    {
+      inode->data.length = length;
+      write_inode (inode);
+    }
+  else
+    deallocate (inode);
+  lock_release (&inode->lock);
+  inode_close (inode);
+  journal_end ();
+  return success;
+}
+
+/* Creates an inode at sector SECTOR that is a copy of INODE
+   but shares INODE's data sectors instead of copying them.
+   Either file gets sectors of its own for the blocks it later
+   writes, so cloning takes constant time per extent and no data
+   space.
+   Returns true if successful.
+   Returns false if INODE is journaled, e.g. a directory, if the
+   file system cannot share sectors, if INODE is too large to
+   clone (see CLONE_MAX_SECTORS), or if memory or disk allocation
+   fails. */
+bool
+inode_clone (struct inode *inode, disk_sector_t sector) 
+{
+  struct inode *clone;
+  bool success = true;
+  size_t cost = 0;
+  size_t i;
+
+  if (is_journaled (inode))
+    return false;
+
+  journal_begin ();
+  if (!inode_create (sector, 0, inode_get_flags (inode))
+      || (clone = inode_open (sector)) == NULL) 
+    {
+      journal_end ();
+      return false;
+    }
+
+  /* Let writes in progress finish first.  They checked for
+     sharing before this clone, so sharing their sectors now
+     would let them change the clone's data too. */
+  lock_acquire (&inode->lock);
+  while (inode->writer_cnt > 0)
+    cond_wait (&inode->writers_done, &inode->lock);
+  if (inode->pending_cnt > 0 && !flush_pending (inode))
+    success = false;
+  for (i = 0; success && i < inode->data.extent_cnt; i++) 
+    {
+      const struct extent *e = extent_at (inode, i);
+      cost += free_map_share_cost (e->start, e->cnt);
+    }
+  if (cost > CLONE_MAX_SECTORS)
+    success = false;
+  for (i = 0; success && i < inode->data.extent_cnt; i++) 
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start))
+      const struct extent *e = extent_at (inode, i);
+      if (!free_map_share (e->start, e->cnt))
+        success = false;
+      else if (!append_extent_at (clone, e->block, e->start, e->cnt)) 
         {
-          disk_write (filesys_disk, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[DISK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                disk_write (filesys_disk, disk_inode->start + i, zeros); 
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+          free_map_release (e->start, e->cnt);
+          success = false;
+        }
     }
+  if (success)
+    clone->data.length = inode->data.length;
+  lock_release (&inode->lock);
+
+  if (!success) 
+    {
+      /* Give back what was shared so far. */
+      deallocate (clone);
+      clone->data.extent_cnt = 0;
+      clone->data.indirect = 0;
+      free (clone->indirect);
+      clone->indirect = NULL;
+    }
+  write_inode (clone);
+  inode_close (clone);
+  journal_end ();
   return success;
 }
 
@@ -111,20 +1045,14 @@ inode_create (disk_sector_t sector, off_t length)
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *other;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
-    {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
-    }
+  /* Check whether this inode is already in memory. */
+  lock_acquire (&inode_table_lock);
+  inode = lookup_inode (sector);
+  lock_release (&inode_table_lock);
+  if (inode != NULL)
+    return inode;
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
@@ -132,12 +1060,41 @@ inode_open (disk_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  disk_read (filesys_disk, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  lock_init (&inode->extend_lock);
+  inode->writer_cnt = 0;
+  cond_init (&inode->writers_done);
+  cache_read (inode->sector, &inode->data);
+  inode->indirect = NULL;
+  inode->pending = NULL;
+  inode->pending_cnt = 0;
+  if (inode->data.indirect != 0) 
+    {
+      inode->indirect = malloc (sizeof *inode->indirect);
+      if (inode->indirect == NULL) 
+        {
+          free (inode);
+          return NULL;
+        }
+      cache_read (inode->data.indirect, inode->indirect);
+    }
+
+  /* Someone else may have opened the inode while we were reading
+     it.  If so, use theirs. */
+  lock_acquire (&inode_table_lock);
+  other = lookup_inode (sector);
+  if (other == NULL)
+    hash_insert (&inode_table, &inode->elem);
+  lock_release (&inode_table_lock);
+  if (other != NULL) 
+    {
+      free_inode (inode);
+      inode = other;
+    }
   return inode;
 }
 
@@ -145,8 +1102,12 @@ inode_open (disk_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  if (inode != NULL)
-    inode->open_cnt++;
+  if (inode != NULL) 
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -158,8 +1119,10 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the cache
+   of closed inodes.
+   If INODE was also a removed inode, frees its blocks and its
+   memory. */
 void
 inode_close (struct inode *inode) 
 {
@@ -167,22 +1130,59 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  journal_begin ();
+
+  /* Write out pending blocks before letting go of the last
+     reference.  Flushing drops the table lock, during which the
+     inode may be reopened and written, so check again after. */
+  lock_acquire (&inode_table_lock);
+  while (inode->open_cnt == 1 && !inode->removed && inode->pending_cnt > 0) 
+    {
+      lock_release (&inode_table_lock);
+
+      /* There is no one left to report a failure to. */
+      lock_acquire (&inode->lock);
+      if (!flush_pending (inode))
+        discard_pending (inode);
+      lock_release (&inode->lock);
+
+      lock_acquire (&inode_table_lock);
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (--inode->open_cnt > 0)
+    lock_release (&inode_table_lock);
+  else if (inode->removed) 
+    {
+      /* Remove from inode table and deallocate blocks. */
+      hash_delete (&inode_table, &inode->elem);
+      lock_release (&inode_table_lock);
+
+      lock_acquire (&inode->lock);
+      discard_pending (inode);
+      lock_release (&inode->lock);
+      free_map_release (inode->sector, 1);
+      deallocate (inode);
+      free_inode (inode);
+    }
+  else 
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      /* Cache it, evicting the least recently closed inodes if
+         the cache is full. */
+      list_push_back (&closed_inodes, &inode->lru_elem);
+      closed_cnt++;
+      while (closed_cnt > inode_cache_size) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          struct inode *victim = list_entry (list_pop_front (&closed_inodes),
+                                             struct inode, lru_elem);
+          hash_delete (&inode_table, &victim->elem);
+          closed_cnt--;
+          free_inode (victim);
         }
-
-      free (inode); 
+      lock_release (&inode_table_lock);
     }
+
+  journal_end ();
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -206,9 +1206,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Block to read, starting byte offset within block. */
+      size_t block = offset / DISK_SECTOR_SIZE;
       int sector_ofs = offset % DISK_SECTOR_SIZE;
+      disk_sector_t sector_idx;
+      size_t first_pending;
+      size_t run;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
       off_t inode_left = inode_length (inode) - offset;
@@ -220,10 +1223,48 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+      /* Pending blocks are read from memory. */
+      lock_acquire (&inode->lock);
+      first_pending = allocated_blocks (inode);
+      if (block >= first_pending && block - first_pending < inode->pending_cnt) 
+        {
+          memcpy (buffer + bytes_read,
+                  inode->pending + ((block - first_pending) * DISK_SECTOR_SIZE
+                                    + sector_ofs),
+                  chunk_size);
+          lock_release (&inode->lock);
+          goto advance;
+        }
+      sector_idx = lookup_block (inode, block, &run);
+      lock_release (&inode->lock);
+
+      if (sector_idx == (disk_sector_t) -1) 
+        {
+          /* Holes read as zeros, without any I/O. */
+          off_t left = size < inode_left ? size : inode_left;
+          if (run < bytes_to_sectors (left + sector_ofs))
+            left = run * DISK_SECTOR_SIZE - sector_ofs;
+          memset (buffer + bytes_read, 0, left);
+          chunk_size = left;
+        }
+      else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE
+          && !is_journaled (inode)) 
+        {
+          /* Read as many whole sectors as lie contiguously on
+             disk straight into the caller's buffer in a single
+             request, which lets the disk driver DMA into it. */
+          off_t whole = (size < inode_left ? size : inode_left)
+                        / DISK_SECTOR_SIZE;
+          if (run > (size_t) whole)
+            run = whole;
+          disk_read_multiple (filesys_disk, sector_idx, run,
+                              buffer + bytes_read);
+          chunk_size = run * DISK_SECTOR_SIZE;
+        }
+      else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
         {
           /* Read full sector directly into caller's buffer. */
-          disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+          read_sector (inode, sector_idx, buffer + bytes_read);
         }
       else 
         {
@@ -235,11 +1276,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          disk_read (filesys_disk, sector_idx, bounce);
+          read_sector (inode, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
       
-      /* Advance. */
+    advance:
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
@@ -251,70 +1292,177 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing beyond end of file extends the inode; any gap between
+   the old end of file and OFFSET reads back as zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t old_length;
+  bool extending;
 
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || size <= 0)
     return 0;
 
-  while (size > 0) 
-    {
-      /* Sector to write, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % DISK_SECTOR_SIZE;
+  /* Only one writer at a time may extend the file, so that one
+     writer's gap zeroing cannot clobber another's data. */
+  extending = offset + size > inode_length (inode);
+  if (extending)
+    lock_acquire (&inode->extend_lock);
+  old_length = inode_length (inode);
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = DISK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+  /* Blocks past end of file may hold garbage, e.g. if they were
+     preallocated, so zero any gap explicitly.  The parts of the
+     gap that are holes cost nothing. */
+  if (offset > old_length
+      && write_blocks (inode, NULL, old_length, offset - old_length,
+                       old_length) != offset - old_length)
+    goto done;
+  bytes_written = write_blocks (inode, buffer_, offset, size, old_length);
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
+  /* Extend the file only once the data is in place, so that
+     concurrent readers never see unwritten bytes.  While blocks
+     are pending, the on-disk inode is brought up to date when
+     they are flushed. */
+  if (offset + bytes_written > inode_length (inode)) 
+    {
+      journal_begin ();
+      lock_acquire (&inode->lock);
+      if (offset + bytes_written > inode->data.length) 
         {
-          /* Write full sector directly to disk. */
-          disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+          inode->data.length = offset + bytes_written;
+          if (inode->pending_cnt == 0)
+            cache_write (inode->sector, &inode->data);
         }
-      else 
+      lock_release (&inode->lock);
+      journal_end ();
+    }
+
+ done:
+  if (extending)
+    lock_release (&inode->extend_lock);
+  return bytes_written;
+}
+
+/* Exchanges the data of inodes A and B, including their lengths
+   but not their flags, and writes both inodes back.  Both inodes
+   change in one journal operation, so a caller can build new
+   contents for A in a scratch inode B, where a crash cannot
+   expose them half written, and then swap them in atomically.
+   The caller must keep other users of A and B away meanwhile.
+   Returns true if successful, false if pending blocks could not
+   be flushed, in which case nothing changes. */
+bool
+inode_exchange (struct inode *a, struct inode *b) 
+{
+  struct inode *first = a->sector < b->sector ? a : b;
+  struct inode *second = first == a ? b : a;
+  struct inode_indirect *indirect;
+  struct inode_disk data;
+  bool success = true;
+
+  ASSERT (a != b);
+
+  journal_begin ();
+  lock_acquire (&first->lock);
+  lock_acquire (&second->lock);
+  if ((a->pending_cnt > 0 && !flush_pending (a))
+      || (b->pending_cnt > 0 && !flush_pending (b)))
+    success = false;
+  else
+    {
+      data = a->data;
+      a->data = b->data;
+      b->data = data;
+      b->data.flags = a->data.flags;
+      a->data.flags = data.flags;
+      indirect = a->indirect;
+      a->indirect = b->indirect;
+      b->indirect = indirect;
+      write_inode (a);
+      write_inode (b);
+    }
+  lock_release (&second->lock);
+  lock_release (&first->lock);
+  journal_end ();
+  return success;
+}
+
+/* Allocates sectors for the LENGTH bytes of INODE's data
+   starting at OFFSET, without changing its length, so that
+   writing that range later needs no further allocation and the
+   data lands in long contiguous runs.
+   Returns true if successful, false if disk space or extents run
+   out. */
+bool
+inode_preallocate (struct inode *inode, off_t offset, off_t length) 
+{
+  bool success;
+
+  ASSERT (offset >= 0 && length >= 0);
+
+  journal_begin ();
+  lock_acquire (&inode->lock);
+  success = grow (inode, offset / DISK_SECTOR_SIZE,
+                  bytes_to_sectors (offset + length), SIZE_MAX);
+  lock_release (&inode->lock);
+  journal_end ();
+  return success;
+}
+
+/* Writes INODE's pending blocks to disk.
+   Returns true if successful, false if the disk is full. */
+bool
+inode_flush (struct inode *inode) 
+{
+  bool success = true;
+
+  journal_begin ();
+  lock_acquire (&inode->lock);
+  if (inode->pending_cnt > 0)
+    success = flush_pending (inode);
+  lock_release (&inode->lock);
+  journal_end ();
+  return success;
+}
+
+/* Writes the pending blocks of every open inode to disk. */
+void
+inode_flush_all (void) 
+{
+  struct inode **inodes;
+  struct hash_iterator i;
+  size_t cnt = 0, max, j;
+
+  /* Pick out the inodes with pending blocks, keeping them open so
+     that they cannot go away while the table lock is dropped for
+     the flushing. */
+  lock_acquire (&inode_table_lock);
+  max = hash_size (&inode_table);
+  inodes = malloc (max * sizeof *inodes);
+  if (inodes != NULL) 
+    {
+      hash_first (&i, &inode_table);
+      while (hash_next (&i)) 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+          if (inode->pending_cnt > 0) 
             {
-              bounce = malloc (DISK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              inode->open_cnt++;
+              inodes[cnt++] = inode;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            disk_read (filesys_disk, sector_idx, bounce);
-          else
-            memset (bounce, 0, DISK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          disk_write (filesys_disk, sector_idx, bounce); 
         }
-
-      /* Advance. */
-      size -= chunk_size;
-      offset += chunk_size;
-      bytes_written += chunk_size;
     }
-  free (bounce);
+  lock_release (&inode_table_lock);
 
-  return bytes_written;
+  for (j = 0; j < cnt; j++) 
+    {
+      inode_flush (inodes[j]);
+      inode_close (inodes[j]);
+    }
+  free (inodes);
 }
 
 /* Disables writes to INODE.
@@ -343,3 +1491,100 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns INODE's flags, a combination of INODE_* bits. */
+unsigned
+inode_get_flags (const struct inode *inode) 
+{
+  return inode->data.flags;
+}
+
+/* Sets INODE's flags to FLAGS and writes them to disk. */
+void
+inode_set_flags (struct inode *inode, unsigned flags) 
+{
+  journal_begin ();
+  lock_acquire (&inode->lock);
+  inode->data.flags = flags;
+  if (inode->pending_cnt == 0)
+    cache_write (inode->sector, &inode->data);
+  lock_release (&inode->lock);
+  journal_end ();
+}
+
+/* Returns a hash value for inode I. */
+static unsigned
+inode_hash (const struct hash_elem *i_, void *aux UNUSED) 
+{
+  const struct inode *i = hash_entry (i_, struct inode, elem);
+  return hash_int (i->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
+}
+
+/* Looks up the in-memory inode for SECTOR.  If there is one,
+   takes it out of the cache of closed inodes if necessary, adds
+   an opener, and returns it.  Otherwise returns a null pointer.
+   inode_table_lock must be held. */
+static struct inode *
+lookup_inode (disk_sector_t sector) 
+{
+  struct inode key;
+  struct hash_elem *e;
+  struct inode *inode;
+
+  ASSERT (lock_held_by_current_thread (&inode_table_lock));
+
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.elem);
+  if (e == NULL)
+    return NULL;
+
+  inode = hash_entry (e, struct inode, elem);
+  if (inode->open_cnt++ == 0) 
+    {
+      list_remove (&inode->lru_elem);
+      closed_cnt--;
+    }
+  return inode;
+}
+
+/* Drops the closed inode for SECTOR, if any, from the cache. */
+static void
+forget_inode (disk_sector_t sector) 
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  lock_acquire (&inode_table_lock);
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.elem);
+  if (e != NULL) 
+    {
+      struct inode *inode = hash_entry (e, struct inode, elem);
+      ASSERT (inode->open_cnt == 0);
+      hash_delete (&inode_table, &inode->elem);
+      list_remove (&inode->lru_elem);
+      closed_cnt--;
+      free_inode (inode);
+    }
+  lock_release (&inode_table_lock);
+}
+
+/* Frees the memory of INODE, which must not be in the inode
+   table. */
+static void
+free_inode (struct inode *inode) 
+{
+  ASSERT (inode->pending == NULL);
+  free (inode->indirect);
+  free (inode);
+}
@@ -2,22 +2,37 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
 struct bitmap;
 
+/* Bits in an inode's flags. */
+#define INODE_INDEXED 0x1               /* Directory in indexed format. */
+#define INODE_JOURNALED 0x2             /* Contents are metadata. */
+
+/* Maximum number of closed inodes kept in memory. */
+extern size_t inode_cache_size;
+
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t);
+bool inode_create (disk_sector_t, off_t, unsigned flags);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
+bool inode_clone (struct inode *, disk_sector_t);
 disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_preallocate (struct inode *, off_t offset, off_t length);
+bool inode_exchange (struct inode *, struct inode *);
+bool inode_flush (struct inode *);
+void inode_flush_all (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+unsigned inode_get_flags (const struct inode *);
+void inode_set_flags (struct inode *, unsigned);
 
 #endif /* filesys/inode.h */
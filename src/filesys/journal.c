@@ -0,0 +1,528 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead metadata journal.
+
+   All changes to metadata go through the buffer cache, where
+   they join the journal's running transaction.  A file system
+   operation brackets its changes with journal_begin() and
+   journal_end(), so that they always end up in the same
+   transaction, and a transaction is only committed when no
+   operation is in progress.  Many operations usually share one
+   transaction.
+
+   Committing a transaction writes every sector it changed to the
+   journal, a region of JOURNAL_SIZE sectors reserved when the
+   disk is formatted, in a single sequential transfer:
+
+        descriptor block, listing the sectors' home locations
+        the sectors' new contents
+        commit block, with a checksum of the above
+
+   Only then may the changed sectors be written to their home
+   locations, which happens lazily, whenever the cache evicts
+   them or at the latest when the journal fills up and has to be
+   checkpointed: then all of them are written home and the
+   journal starts over from its beginning.
+
+   A checkpoint must happen right after a commit, while no newer
+   transaction has changed anything.  The cache keeps only the
+   latest contents of a sector, so once a newer transaction has
+   rewritten a sector that is in the log, the logged contents
+   can no longer be written home, and emptying the log would lose
+   them if the system went down before the newer transaction
+   committed.  So commit() checkpoints as soon as the log might
+   not hold another transaction of the largest size.
+
+   After a crash, journal_open() replays every complete
+   transaction found in the journal, so that the metadata on disk
+   reflects exactly the transactions committed before the crash.
+
+   Transactions are numbered consecutively.  The journal header,
+   in JOURNAL_SECTOR, holds the number of the transaction that
+   starts at the beginning of the journal; any other number there
+   belongs to an earlier round and marks the end of the log.
+
+   A transaction is committed when an operation ends and
+        - someone asked for it with journal_request_commit(), or
+        - it changed JOURNAL_COMMIT_SECTORS sectors, or
+        - JOURNAL_COMMIT_INTERVAL ticks passed since the last one.
+   So a crash loses at most the last moments of metadata changes,
+   but never leaves the metadata inconsistent.
+
+   Once the running transaction is due to commit, journal_begin()
+   holds off new operations until the ones in progress have ended
+   and the transaction has committed.  Otherwise overlapping
+   operations could keep it open forever, and it would outgrow
+   the DESC_ENTRY_CNT sectors one descriptor can log.  As it is, a
+   transaction holds at most JOURNAL_COMMIT_SECTORS sectors plus
+   whatever the operations in progress at that point still add.
+   Nested calls never wait, but an operation must not start
+   while holding a lock that an operation in progress may need,
+   and it should not keep its handle across data I/O.
+
+   A caller that needs its changes on disk now, such as fsync(),
+   calls journal_sync(), which waits until the transaction holding
+   them has committed.  Syncs group-commit: everyone who calls
+   journal_sync() while a commit is pending waits for the same
+   one, and when the last commit served more than one caller, the
+   first caller holds the commit back for JOURNAL_SYNC_WINDOW
+   ticks so that the others can join it.  With many processes
+   syncing at once, this turns one journal write per call into
+   one per group.  A sync's commit request holds off new
+   operations like any other, so it finishes even while other
+   processes keep writing. */
+
+/* Journal size in sectors: room for a few transactions of the
+   largest size, so that not every commit needs a checkpoint. */
+#define JOURNAL_SIZE (4 * (DESC_ENTRY_CNT + 2))
+
+/* When to commit, see above. */
+#define JOURNAL_COMMIT_SECTORS 32
+#define JOURNAL_COMMIT_INTERVAL TIMER_FREQ
+
+/* How long to gather journal_sync() callers, in timer ticks. */
+#define JOURNAL_SYNC_WINDOW 1
+
+/* Magic numbers. */
+#define JOURNAL_MAGIC 0x4a524e4c        /* Journal header. */
+#define DESC_MAGIC 0x4a445343           /* Descriptor block. */
+#define COMMIT_MAGIC 0x4a434d54         /* Commit block. */
+
+/* Sectors listed in one descriptor block, and so the most sectors
+   one transaction can log. */
+#define DESC_ENTRY_CNT 125
+
+/* Journal header.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    disk_sector_t start;                /* First sector of the log. */
+    uint32_t size;                      /* Log size in sectors. */
+    uint32_t seq;                       /* Transaction at START. */
+    uint32_t unused[124];               /* Not used. */
+  };
+
+/* Descriptor block.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_desc
+  {
+    unsigned magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    disk_sector_t sectors[DESC_ENTRY_CNT]; /* Their home locations. */
+  };
+
+/* Commit block.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_commit
+  {
+    unsigned magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction number. */
+    uint32_t checksum;                  /* Hash of descriptor and data. */
+    uint32_t unused[125];               /* Not used. */
+  };
+
+static struct journal_header header;    /* Journal header. */
+static bool active;                     /* Accepting transactions? */
+static unsigned running_tid;            /* Transaction changes join. */
+static unsigned committed_tid;          /* Last committed transaction. */
+static int handle_cnt;                  /* Operations in progress. */
+static bool commit_wanted;              /* Commit when they end? */
+static size_t head;                     /* Next free sector in the log. */
+static int64_t last_commit;             /* Time of last commit. */
+static uint8_t *log_buf;                /* Transaction being written. */
+static struct bitmap *logged;           /* Sectors with images in the log. */
+static int sync_cnt;                    /* Callers in journal_sync(). */
+static bool window_open;                /* Gathering sync callers? */
+static int last_group;                  /* Callers served by last commit. */
+static struct lock journal_lock;        /* Protects the above. */
+static struct condition commit_done;    /* Signaled by each commit. */
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions committed. */
+static long long logged_cnt;            /* Sectors written to the log. */
+static long long sync_call_cnt;         /* Calls to journal_sync(). */
+
+static bool commit_due (void);
+static void replay (void);
+static void commit (void);
+static void checkpoint (void);
+
+/* Initializes the journal module.  The journal is inactive until
+   journal_open() is called: until then, metadata changes are
+   written back without any ordering guarantees. */
+void
+journal_init (void)
+{
+  lock_init (&journal_lock);
+  cond_init (&commit_done);
+  active = false;
+  handle_cnt = 0;
+  sync_cnt = 0;
+  window_open = false;
+  last_group = 0;
+}
+
+/* Sets aside a journal on a newly formatted disk. */
+void
+journal_create (void)
+{
+  disk_sector_t start;
+
+  ASSERT (sizeof header == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == DISK_SECTOR_SIZE);
+
+  if (!free_map_allocate (JOURNAL_SIZE, &start))
+    PANIC ("journal creation failed--disk is too small");
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.start = start;
+  header.size = JOURNAL_SIZE;
+  header.seq = 1;
+  disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Reads the journal header, replays any transactions committed
+   but not checkpointed before the system went down, and starts
+   journaling metadata changes. */
+void
+journal_open (void)
+{
+  disk_read (filesys_disk, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("file system has no journal (reformat with -f)");
+
+  log_buf = malloc ((DESC_ENTRY_CNT + 2) * DISK_SECTOR_SIZE);
+  logged = bitmap_create (disk_size (filesys_disk));
+  if (log_buf == NULL || logged == NULL)
+    PANIC ("out of memory for journal");
+  replay ();
+
+  head = 0;
+  running_tid = header.seq;
+  committed_tid = header.seq - 1;
+  commit_wanted = false;
+  last_commit = timer_ticks ();
+  active = true;
+  cache_set_tids (running_tid, committed_tid);
+}
+
+/* Commits and checkpoints all outstanding changes and stops
+   journaling. */
+void
+journal_close (void)
+{
+  lock_acquire (&journal_lock);
+  ASSERT (handle_cnt == 0);
+  commit ();
+  checkpoint ();
+  lock_release (&journal_lock);
+
+  /* Everything is checkpointed now, so all deferred frees can
+     happen.  Commit those too. */
+  free_map_release_deferred ();
+  lock_acquire (&journal_lock);
+  commit ();
+  checkpoint ();
+  active = false;
+  cache_set_tids (0, 0);
+  lock_release (&journal_lock);
+
+  free (log_buf);
+  bitmap_destroy (logged);
+}
+
+/* Starts a file system operation.  All the metadata changes made
+   until the matching journal_end() will be committed together.
+   Operations may nest.  An outermost operation first waits for
+   the running transaction to commit if it is due to. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_acquire (&journal_lock);
+  if (t->journal_depth++ == 0) 
+    {
+      while (active && commit_due ())
+        if (handle_cnt == 0)
+          {
+            commit ();
+            lock_release (&journal_lock);
+            free_map_release_deferred ();
+            lock_acquire (&journal_lock);
+          }
+        else
+          cond_wait (&commit_done, &journal_lock);
+    }
+  handle_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends a file system operation started with journal_begin().
+   If no other operation is in progress, commits the running
+   transaction if it is time to. */
+void
+journal_end (void)
+{
+  bool committed = false;
+
+  lock_acquire (&journal_lock);
+  ASSERT (handle_cnt > 0);
+  ASSERT (thread_current ()->journal_depth > 0);
+  thread_current ()->journal_depth--;
+  if (--handle_cnt == 0 && active && commit_due ())
+    {
+      commit ();
+      committed = true;
+    }
+  lock_release (&journal_lock);
+
+  if (committed)
+    free_map_release_deferred ();
+}
+
+/* Waits until all the metadata changes made so far are committed
+   to the journal, committing them if necessary.  Callers that
+   arrive together share one commit.  Must not be called inside
+   an operation, which would wait for itself. */
+void
+journal_sync (void)
+{
+  unsigned target;
+  bool committed = false;
+
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  sync_call_cnt++;
+  target = cache_running_cnt () > 0 ? running_tid : running_tid - 1;
+  if (!active || committed_tid >= target)
+    {
+      lock_release (&journal_lock);
+      return;
+    }
+
+  sync_cnt++;
+  if (sync_cnt == 1 && last_group > 1 && !window_open)
+    {
+      /* Others have been syncing too.  Give them a moment to
+         join this commit. */
+      window_open = true;
+      lock_release (&journal_lock);
+      timer_sleep (JOURNAL_SYNC_WINDOW);
+      lock_acquire (&journal_lock);
+      window_open = false;
+    }
+
+  /* This is also a barrier: journal_begin() lets no new
+     operation start until the commit, so the operations in
+     progress drain and the commit happens however busy the file
+     system is. */
+  commit_wanted = true;
+  while (committed_tid < target)
+    if (handle_cnt == 0 && !window_open)
+      {
+        last_group = sync_cnt;
+        commit ();
+        committed = true;
+      }
+    else
+      cond_wait (&commit_done, &journal_lock);
+  sync_cnt--;
+  lock_release (&journal_lock);
+
+  if (committed)
+    free_map_release_deferred ();
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld commits, %lld sectors logged, %lld syncs\n",
+          commit_cnt, logged_cnt, sync_call_cnt);
+}
+
+/* Asks for the running transaction to be committed as soon as
+   no operation is in progress.  Until then, no new operation may
+   start. */
+void
+journal_request_commit (void)
+{
+  lock_acquire (&journal_lock);
+  commit_wanted = true;
+  lock_release (&journal_lock);
+}
+
+/* Returns the number of the running transaction, or 0 if the
+   journal is inactive. */
+unsigned
+journal_running_tid (void)
+{
+  return active ? running_tid : 0;
+}
+
+/* Returns true if transaction TID has been committed. */
+bool
+journal_committed (unsigned tid)
+{
+  return tid <= committed_tid;
+}
+
+/* Returns true if the journal holds an image of any of the CNT
+   sectors starting at SECTOR.  Such sectors must not be reused
+   for file data until the journal is checkpointed, since replay
+   would overwrite the data with the stale image. */
+bool
+journal_logged (disk_sector_t sector, size_t cnt)
+{
+  return active && bitmap_contains (logged, sector, cnt, true);
+}
+
+/* Returns true if the running transaction should be committed
+   as soon as no operation is in progress.
+   journal_lock must be held. */
+static bool
+commit_due (void)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  return (commit_wanted
+          || cache_running_cnt () >= JOURNAL_COMMIT_SECTORS
+          || timer_elapsed (last_commit) >= JOURNAL_COMMIT_INTERVAL);
+}
+
+/* Replays the complete transactions in the log, writing their
+   sectors home, then empties the log. */
+static void
+replay (void)
+{
+  struct journal_desc *desc = (struct journal_desc *) log_buf;
+  size_t pos = 0;
+  int replayed = 0;
+
+  while (pos + 2 <= header.size)
+    {
+      struct journal_commit *c;
+      size_t i;
+
+      disk_read (filesys_disk, header.start + pos, desc);
+      if (desc->magic != DESC_MAGIC || desc->seq != header.seq
+          || desc->cnt > DESC_ENTRY_CNT || pos + desc->cnt + 2 > header.size)
+        break;
+      disk_read_multiple (filesys_disk, header.start + pos + 1, desc->cnt + 1,
+                          log_buf + DISK_SECTOR_SIZE);
+      c = (struct journal_commit *) (log_buf
+                                     + (desc->cnt + 1) * DISK_SECTOR_SIZE);
+      if (c->magic != COMMIT_MAGIC || c->seq != header.seq
+          || c->checksum != hash_bytes (log_buf,
+                                        (desc->cnt + 1) * DISK_SECTOR_SIZE))
+        break;
+
+      for (i = 0; i < desc->cnt; i++)
+        cache_write (desc->sectors[i], log_buf + (i + 1) * DISK_SECTOR_SIZE);
+      pos += desc->cnt + 2;
+      header.seq++;
+      replayed++;
+    }
+
+  if (replayed > 0)
+    {
+      printf ("journal: replayed %d transaction(s)\n", replayed);
+      cache_flush ();
+    }
+  disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
+
+/* Commits the running transaction to the log, then checkpoints
+   if the log might not have room for the next one.
+   journal_lock must be held and no operation may be in
+   progress. */
+static void
+commit (void)
+{
+  struct journal_desc *desc = (struct journal_desc *) log_buf;
+  struct journal_commit *c;
+  unsigned tid = running_tid;
+  size_t cnt, i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (handle_cnt == 0);
+
+  cnt = cache_collect (desc->sectors, log_buf + DISK_SECTOR_SIZE,
+                       DESC_ENTRY_CNT);
+  running_tid++;
+  commit_wanted = false;
+  last_commit = timer_ticks ();
+  cond_broadcast (&commit_done, &journal_lock);
+  if (cnt > DESC_ENTRY_CNT)
+    {
+      /* journal_begin() keeps transactions well below this size.
+         Writing the sectors home unlogged would give up exactly
+         the atomicity the journal is for. */
+      PANIC ("journal: %zu-sector transaction too large to log", cnt);
+    }
+  if (cnt == 0)
+    {
+      committed_tid = tid;
+      cache_set_committed (tid);
+      return;
+    }
+  ASSERT (head + cnt + 2 <= header.size);
+
+  desc->magic = DESC_MAGIC;
+  desc->seq = tid;
+  desc->cnt = cnt;
+  c = (struct journal_commit *) (log_buf + (cnt + 1) * DISK_SECTOR_SIZE);
+  memset (c, 0, sizeof *c);
+  c->magic = COMMIT_MAGIC;
+  c->seq = tid;
+  c->checksum = hash_bytes (log_buf, (cnt + 1) * DISK_SECTOR_SIZE);
+  disk_write_multiple (filesys_disk, header.start + head, cnt + 2, log_buf);
+  head += cnt + 2;
+  commit_cnt++;
+  logged_cnt += cnt;
+  for (i = 0; i < cnt; i++)
+    bitmap_mark (logged, desc->sectors[i]);
+
+  committed_tid = tid;
+  cache_set_committed (tid);
+
+  /* No operation is in progress, so the next transaction has not
+     changed any sector yet and every logged sector can still go
+     home.  See the comment at the top of this file. */
+  if (head + DESC_ENTRY_CNT + 2 > header.size)
+    {
+      ASSERT (cache_running_cnt () == 0);
+      checkpoint ();
+    }
+}
+
+/* Writes every committed sector home and empties the log.
+   journal_lock must be held. */
+static void
+checkpoint (void)
+{
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+
+  cache_flush ();
+  head = 0;
+  bitmap_set_all (logged, false);
+  header.seq = committed_tid + 1;
+  disk_write (filesys_disk, JOURNAL_SECTOR, &header);
+}
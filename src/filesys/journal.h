@@ -0,0 +1,23 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_request_commit (void);
+void journal_sync (void);
+void journal_print_stats (void);
+
+unsigned journal_running_tid (void);
+bool journal_committed (unsigned tid);
+bool journal_logged (disk_sector_t, size_t cnt);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Maximum characters in a file name component. */
+#define DIRENT_NAME_MAX 14
+
+/* A directory entry, as returned in bulk by readdir_many(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated name. */
+  };
+
+#endif /* lib/dirent.h */
@@ -1,31 +1,66 @@
 #include <syscall.h>
+#include <stdint.h>
 #include "../syscall-nr.h"
 
+/* How a system call enters the kernel.  The syscallN macros
+   push the arguments and then the system call number and call
+   through syscall_entry to one of the stubs below, so that the
+   stub sees its return address at the top of the stack and the
+   number just above it.  Both stubs clobber %ecx and %edx.
+   The arguments are passed in registers, because an operand
+   addressed relative to %esp would be wrong after the first
+   push.
+
+   syscall_int uses "int $0x30", which works on any CPU.
+
+   syscall_sysenter uses SYSENTER, which is much faster.  It
+   passes the kernel the stack pointer the caller will have
+   after the stub returns, which points to the system call
+   number, in %ecx and the return address in %edx.  The kernel's
+   SYSEXIT goes straight back to the caller. */
+void syscall_int (void);
+void syscall_sysenter (void);
+asm (".text\n"
+     "syscall_int:\n"
+     "\tpopl %edx\n"
+     "\tint $0x30\n"
+     "\tjmp *%edx\n"
+     "syscall_sysenter:\n"
+     "\tmovl (%esp), %edx\n"
+     "\tleal 4(%esp), %ecx\n"
+     "\tsysenter\n");
+
+/* Stub through which system calls enter the kernel. */
+static void (*syscall_entry) (void) = syscall_int;
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; call *%[entry]; addl $4, %%esp"  \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry)                    \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; "                 \
+             "call *%[entry]; addl $8, %%esp"                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "r" (ARG0)                              \
+               : "ecx", "edx", "memory");                       \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +70,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $12, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
-                 [arg0] "g" (ARG0),                             \
-                 [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1)                              \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
@@ -51,16 +87,34 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; call *%[entry]; addl $16, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
-                 [arg0] "g" (ARG0),                             \
-                 [arg1] "g" (ARG1),                             \
-                 [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+                 [entry] "m" (syscall_entry),                   \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2)                              \
+               : "ecx", "edx", "memory");                       \
           retval;                                               \
         })
 
+/* Makes system calls enter the kernel with SYSENTER if FAST is
+   true and the CPU supports it, otherwise with "int $0x30".
+   Returns true if SYSENTER is now in use. */
+bool
+syscall_use_sysenter (bool fast) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  if (fast)
+    {
+      asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+      fast = (edx & (1u << 11)) != 0;
+    }
+  syscall_entry = fast ? syscall_sysenter : syscall_int;
+  return fast;
+}
+
 void
 halt (void) 
 {
@@ -182,3 +236,33 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+readdir_many (int fd, struct dirent *entries, unsigned max) 
+{
+  return syscall3 (SYS_READDIR_MANY, fd, entries, max);
+}
+
+bool
+fsync (int fd) 
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void) 
+{
+  syscall0 (SYS_SYNC);
+}
+
+bool
+reflink (const char *file, const char *new_file) 
+{
+  return syscall2 (SYS_REFLINK, file, new_file);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
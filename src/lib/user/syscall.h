@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -44,5 +45,15 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int readdir_many (int fd, struct dirent *, unsigned max);
+bool fsync (int fd);
+void sync (void);
+bool reflink (const char *file, const char *new_file);
+
+/* Extensions. */
+pid_t fork (void);
+
+/* Choosing how system calls enter the kernel. */
+bool syscall_use_sysenter (bool);
 
 #endif /* lib/user/syscall.h */
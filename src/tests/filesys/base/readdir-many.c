@@ -0,0 +1,74 @@
+/* Lists a directory with readdir_many() a few entries at a time
+   and checks that each file appears exactly once.  Lists it once
+   while it is small enough to be searched linearly and again
+   after it has grown past DIR_INDEX_THRESHOLD entries and been
+   indexed. */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 40
+#define BATCH 3
+
+/* Creates files "d/f<FIRST>" through "d/f<LAST - 1>". */
+static void
+create_files (int first, int last) 
+{
+  char name[16];
+  int i;
+
+  msg ("create \"d/f%d\" through \"d/f%d\"", first, last - 1);
+  for (i = first; i < last; i++) 
+    {
+      snprintf (name, sizeof name, "d/f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+}
+
+/* Lists "d" BATCH entries at a time and checks that it contains
+   each of "f0" through "f<CNT - 1>" exactly once and nothing
+   else. */
+static void
+check_listing (int cnt) 
+{
+  struct dirent entries[BATCH];
+  int seen[FILE_CNT];
+  int fd, got, i;
+
+  memset (seen, 0, sizeof seen);
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  while ((got = readdir_many (fd, entries, BATCH)) > 0) 
+    for (i = 0; i < got; i++) 
+      {
+        const char *name = entries[i].name;
+        int n = atoi (name + 1);
+
+        if (name[0] != 'f' || n < 0 || n >= cnt)
+          fail ("unexpected entry \"%s\"", name);
+        if (seen[n]++)
+          fail ("entry \"%s\" listed twice", name);
+      }
+  CHECK (got == 0, "readdir_many \"d\" until it returns 0");
+  for (i = 0; i < cnt; i++)
+    if (!seen[i])
+      fail ("entry \"f%d\" not listed", i);
+  msg ("listed each of %d files once", cnt);
+  msg ("close \"d\"");
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  create_files (0, FILE_CNT / 2);
+  check_listing (FILE_CNT / 2);
+  create_files (FILE_CNT / 2, FILE_CNT);
+  check_listing (FILE_CNT);
+}
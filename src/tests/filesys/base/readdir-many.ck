@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readdir-many) begin
+(readdir-many) mkdir "d"
+(readdir-many) create "d/f0" through "d/f19"
+(readdir-many) open "d"
+(readdir-many) readdir_many "d" until it returns 0
+(readdir-many) listed each of 20 files once
+(readdir-many) close "d"
+(readdir-many) create "d/f20" through "d/f39"
+(readdir-many) open "d"
+(readdir-many) readdir_many "d" until it returns 0
+(readdir-many) listed each of 40 files once
+(readdir-many) close "d"
+(readdir-many) end
+EOF
+pass;
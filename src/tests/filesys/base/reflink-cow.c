@@ -0,0 +1,73 @@
+/* Clones a file twice, writes to the original and to one clone,
+   and checks that each write shows up only in the file written.
+   Then removes a clone and the original in turn and checks that
+   the files left still read correctly. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 4096
+
+static char orig[FILE_SIZE];
+static char a[FILE_SIZE];
+static char b[FILE_SIZE];
+
+/* Writes SIZE bytes of DATA at offset OFS in FILE_NAME, and the
+   same bytes into EXPECTED. */
+static void
+write_at (const char *file_name, char *expected, size_t ofs,
+          const char *data, size_t size) 
+{
+  int fd;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  seek (fd, ofs);
+  CHECK (write (fd, data, size) == (int) size,
+         "write %zu bytes at offset %zu in \"%s\"", size, ofs, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  memcpy (expected + ofs, data, size);
+}
+
+void
+test_main (void) 
+{
+  static char data[1000];
+  int fd;
+
+  random_init (0);
+  random_bytes (orig, sizeof orig);
+  random_bytes (data, sizeof data);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+  CHECK (write (fd, orig, sizeof orig) == sizeof orig, "write \"a\"");
+  msg ("close \"a\"");
+  close (fd);
+  memcpy (a, orig, sizeof a);
+  memcpy (b, orig, sizeof b);
+
+  CHECK (reflink ("a", "b"), "reflink \"a\" to \"b\"");
+  CHECK (reflink ("a", "c"), "reflink \"a\" to \"c\"");
+  check_file ("b", b, sizeof b);
+
+  write_at ("a", a, 700, data, 1000);
+  check_file ("a", a, sizeof a);
+  check_file ("b", b, sizeof b);
+  check_file ("c", orig, sizeof orig);
+
+  write_at ("b", b, 3000, data, 500);
+  check_file ("a", a, sizeof a);
+  check_file ("b", b, sizeof b);
+  check_file ("c", orig, sizeof orig);
+
+  CHECK (remove ("b"), "remove \"b\"");
+  check_file ("a", a, sizeof a);
+  check_file ("c", orig, sizeof orig);
+
+  CHECK (remove ("a"), "remove \"a\"");
+  check_file ("c", orig, sizeof orig);
+}
@@ -0,0 +1,53 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(reflink-cow) begin
+(reflink-cow) create "a"
+(reflink-cow) open "a"
+(reflink-cow) write "a"
+(reflink-cow) close "a"
+(reflink-cow) reflink "a" to "b"
+(reflink-cow) reflink "a" to "c"
+(reflink-cow) open "b" for verification
+(reflink-cow) verified contents of "b"
+(reflink-cow) close "b"
+(reflink-cow) open "a"
+(reflink-cow) write 1000 bytes at offset 700 in "a"
+(reflink-cow) close "a"
+(reflink-cow) open "a" for verification
+(reflink-cow) verified contents of "a"
+(reflink-cow) close "a"
+(reflink-cow) open "b" for verification
+(reflink-cow) verified contents of "b"
+(reflink-cow) close "b"
+(reflink-cow) open "c" for verification
+(reflink-cow) verified contents of "c"
+(reflink-cow) close "c"
+(reflink-cow) open "b"
+(reflink-cow) write 500 bytes at offset 3000 in "b"
+(reflink-cow) close "b"
+(reflink-cow) open "a" for verification
+(reflink-cow) verified contents of "a"
+(reflink-cow) close "a"
+(reflink-cow) open "b" for verification
+(reflink-cow) verified contents of "b"
+(reflink-cow) close "b"
+(reflink-cow) open "c" for verification
+(reflink-cow) verified contents of "c"
+(reflink-cow) close "c"
+(reflink-cow) remove "b"
+(reflink-cow) open "a" for verification
+(reflink-cow) verified contents of "a"
+(reflink-cow) close "a"
+(reflink-cow) open "c" for verification
+(reflink-cow) verified contents of "c"
+(reflink-cow) close "c"
+(reflink-cow) remove "a"
+(reflink-cow) open "c" for verification
+(reflink-cow) verified contents of "c"
+(reflink-cow) close "c"
+(reflink-cow) end
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Tries to clone a file too large to clone in one journal
+   operation, which must fail without creating the clone.  Then
+   removes the file and checks that a small file still clones. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE (5 * 1024 * 1024)
+
+static char buf[8192];
+
+void
+test_main (void) 
+{
+  size_t ofs;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("big", 0), "create \"big\"");
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  msg ("write \"big\"");
+  for (ofs = 0; ofs < BIG_SIZE; ofs += sizeof buf)
+    if (write (fd, buf, sizeof buf) != sizeof buf)
+      fail ("write %zu bytes at offset %zu in \"big\" failed",
+            sizeof buf, ofs);
+  msg ("close \"big\"");
+  close (fd);
+
+  CHECK (!reflink ("big", "clone"),
+         "reflink \"big\" to \"clone\" (must fail)");
+  CHECK (open ("clone") == -1, "open \"clone\" (must return -1)");
+  CHECK (remove ("big"), "remove \"big\"");
+
+  CHECK (create ("small", 0), "create \"small\"");
+  CHECK ((fd = open ("small")) > 1, "open \"small\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"small\"");
+  msg ("close \"small\"");
+  close (fd);
+  CHECK (reflink ("small", "clone"), "reflink \"small\" to \"clone\"");
+  CHECK (remove ("small"), "remove \"small\"");
+  check_file ("clone", buf, sizeof buf);
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(reflink-large) begin
+(reflink-large) create "big"
+(reflink-large) open "big"
+(reflink-large) write "big"
+(reflink-large) close "big"
+(reflink-large) reflink "big" to "clone" (must fail)
+(reflink-large) open "clone" (must return -1)
+(reflink-large) remove "big"
+(reflink-large) create "small"
+(reflink-large) open "small"
+(reflink-large) write "small"
+(reflink-large) close "small"
+(reflink-large) reflink "small" to "clone"
+(reflink-large) remove "small"
+(reflink-large) open "clone" for verification
+(reflink-large) verified contents of "clone"
+(reflink-large) close "clone"
+(reflink-large) end
+EOF
+pass;
@@ -0,0 +1,92 @@
+/* Forks a child, which starts out sharing the parent's data and
+   stack pages copy-on-write.  Parent and child then each write
+   their own values into the shared pages and check that they do
+   not see the other's.
+
+   Then maps a file, writes to the mapping, and forks a second
+   child, which must not inherit the mapping.  The parent's
+   writes to the mapping after the fork must still reach the
+   file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+
+static char buf[2 * PAGE_SIZE];
+static char file_buf[PAGE_SIZE];
+
+/* Fails unless the SIZE bytes at P all equal C. */
+static void
+check_fill (const char *p, char c, size_t size, const char *what)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (p[i] != c)
+      fail ("%s: byte %zu is '%c', expected '%c'", what, i, p[i], c);
+}
+
+void
+test_main (void)
+{
+  char stack_buf[128];
+  char *mapped = (char *) 0x10000000;
+  mapid_t map;
+  int handle;
+  pid_t pid;
+
+  memset (buf, 'o', sizeof buf);
+  memset (stack_buf, 'o', sizeof stack_buf);
+
+  quiet = true;
+  CHECK ((pid = fork ()) != -1, "fork");
+  quiet = false;
+  if (pid == 0) 
+    {
+      /* Child: write the first page and the stack buffer. */
+      memset (buf, 'c', PAGE_SIZE);
+      memset (stack_buf, 'c', sizeof stack_buf);
+      check_fill (buf, 'c', PAGE_SIZE, "child's page in child");
+      check_fill (buf + PAGE_SIZE, 'o', PAGE_SIZE, "parent's page in child");
+      check_fill (stack_buf, 'c', sizeof stack_buf, "stack in child");
+      exit (42);
+    }
+
+  /* Parent: write the second page and the stack buffer. */
+  memset (buf + PAGE_SIZE, 'p', PAGE_SIZE);
+  memset (stack_buf, 'p', sizeof stack_buf);
+  CHECK (wait (pid) == 42, "wait for child");
+  check_fill (buf, 'o', PAGE_SIZE, "child's page in parent");
+  check_fill (buf + PAGE_SIZE, 'p', PAGE_SIZE, "parent's page in parent");
+  check_fill (stack_buf, 'p', sizeof stack_buf, "stack in parent");
+  msg ("parent and child saw only their own writes");
+
+  CHECK (create ("mapped", PAGE_SIZE), "create \"mapped\"");
+  CHECK ((handle = open ("mapped")) > 1, "open \"mapped\"");
+  CHECK ((map = mmap (handle, mapped)) != MAP_FAILED, "mmap \"mapped\"");
+  memset (mapped, 'm', PAGE_SIZE);
+
+  quiet = true;
+  CHECK ((pid = fork ()) != -1, "fork");
+  quiet = false;
+  if (pid == 0) 
+    {
+      /* Child: the mapping is not ours, so this must kill us. */
+      check_fill (mapped, 'm', PAGE_SIZE, "mapping in child");
+      exit (43);
+    }
+
+  /* Parent: the mapping is still writable and shared with the
+     file. */
+  memset (mapped, 'p', PAGE_SIZE);
+  CHECK (wait (pid) == -1, "wait for child");
+  munmap (map);
+  seek (handle, 0);
+  CHECK (read (handle, file_buf, PAGE_SIZE) == PAGE_SIZE, "read \"mapped\"");
+  check_fill (file_buf, 'p', PAGE_SIZE, "file after munmap");
+  close (handle);
+  msg ("parent's writes to the mapping reached the file");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+fork-cow: exit(42)
+(fork-cow) wait for child
+(fork-cow) parent and child saw only their own writes
+(fork-cow) create "mapped"
+(fork-cow) open "mapped"
+(fork-cow) mmap "mapped"
+fork-cow: exit(-1)
+(fork-cow) wait for child
+(fork-cow) read "mapped"
+(fork-cow) parent's writes to the mapping reached the file
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
@@ -31,8 +31,18 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "devices/iosched.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 #endif
 
 /* Amount of physical memory, in 4 kB pages. */
@@ -115,6 +125,12 @@ main (void)
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init ();
+  swap_init ();
+#endif
+
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -239,6 +255,16 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (value == NULL || !iosched_set_policy (value))
+            PANIC ("unknown I/O scheduler `%s' (use -h for help)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-nodma"))
+        disk_dma = false;
+      else if (!strcmp (name, "-icache"))
+        inode_cache_size = atoi (value);
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -247,6 +273,14 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-fdmax"))
+        fd_max = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-faultaround"))
+        fault_around = atoi (value);
+      else if (!strcmp (name, "-stackmax"))
+        stack_max = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -347,10 +381,21 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -iosched=POLICY    Schedule disk requests with POLICY:\n"
+          "                     noop, cscan (default), or deadline.\n"
+          "  -nodma             Use PIO even if disk DMA is available.\n"
+          "  -icache=COUNT      Keep up to COUNT closed inodes in memory.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -fdmax=COUNT       Let a process have COUNT files open.\n"
+#endif
+#ifdef VM
+          "  -faultaround=COUNT Map up to COUNT pages per page fault.\n"
+          "  -stackmax=COUNT    Let a process's stack grow to COUNT pages.\n"
 #endif
           );
   power_off ();
@@ -389,10 +434,16 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  page_print_stats ();
+#endif
 }
@@ -536,6 +536,13 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = priority;
 	t->original_priority = priority;
   t->magic = THREAD_MAGIC;
+#ifdef USERPROG
+  list_init (&t->children);
+  t->exit_code = -1;
+#ifdef VM
+  list_init (&t->mappings);
+#endif
+#endif
 	
 	// project1 holding_locks_list init
 	list_init(&t->holding_locks_list);
@@ -95,6 +95,29 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct wait_status *wait_status;    /* This process's completion. */
+    struct list children;               /* Completion of children. */
+    struct file *bin_file;              /* Executable. */
+    int exit_code;                      /* Exit code. */
+#ifdef VM
+    struct hash *pages;                 /* Supplemental page table. */
+#endif
+
+    /* Owned by userprog/syscall.c. */
+    struct intr_frame *syscall_frame;   /* Frame of system call in
+                                           progress. */
+    struct file_descriptor *fds;        /* File descriptor table. */
+    uint32_t *fd_used;                  /* Bitmap of FDS entries in use. */
+    size_t fd_cnt;                      /* Number of FDS entries. */
+#ifdef VM
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapping;                   /* Next mapping id. */
+#endif
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nested journal_begin() calls. */
 #endif
 
     /* Owned by thread.c. */
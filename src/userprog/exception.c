@@ -2,8 +2,12 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/usercopy.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -148,9 +152,29 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
+#ifdef VM
+  /* Bring in the page that was touched, if the process has
+     one there, or give the process its own copy of a page it
+     shares copy-on-write and tried to write. */
+  if ((not_present || write) && page_in (fault_addr, write))
+    return;
+
+  /* Grow the stack, if that is what the process touched.  A
+     fault in kernel mode was taken during a system call, so the
+     process's stack pointer is in the system call's frame. */
+  if (not_present)
+    {
+      struct intr_frame *uf = user ? f : thread_current ()->syscall_frame;
+      if (uf != NULL && page_grow_stack (fault_addr, uf->esp))
+        return;
+    }
+#endif
+
+  /* A system call passed a bad user pointer to the kernel, which
+     faulted copying to or from it.  Make the copy fail. */
+  if (!user && usercopy_fixup (f))
+    return;
+
   printf ("Page fault at %p: %s error %s page in %s context.\n",
           fault_addr,
           not_present ? "not present" : "rights violation",
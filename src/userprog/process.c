@@ -7,6 +7,7 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
@@ -14,43 +15,88 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func execute_thread NO_RETURN;
-static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static thread_func fork_thread NO_RETURN;
+static struct wait_status *create_wait_status (void);
+static bool load (const char *cmd_line, void (**eip) (void), void **esp);
+
+/* A child process's completion status, shared between the child
+   and its parent.  Whichever of them finishes with it last frees
+   it. */
+struct wait_status
+  {
+    struct list_elem elem;              /* `children' list element. */
+    struct lock lock;                   /* Protects ref_cnt. */
+    int ref_cnt;                        /* 2=child and parent both alive,
+                                           1=either child or parent alive,
+                                           0=child and parent both dead. */
+    tid_t tid;                          /* Child thread id. */
+    int exit_code;                      /* Child exit code, if dead. */
+    struct semaphore dead;              /* 1=child alive, 0=child dead. */
+  };
+
+/* Data structure shared between process_execute() in the
+   invoking thread and execute_thread() in the newly invoked
+   thread. */
+struct exec_info 
+  {
+    const char *cmd_line;               /* Program to load. */
+    struct semaphore load_done;         /* "Up"ed when loading complete. */
+    struct wait_status *wait_status;    /* Child process. */
+    bool success;                       /* Program successfully loaded? */
+  };
 
 /* Starts a new thread running a user program loaded from
-   FILENAME.  The new thread may be scheduled (and may even exit)
-   before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   CMD_LINE, whose first word is the program's file name and
+   whose remaining words are its arguments.  Waits for the
+   program to load.  Returns the new process's thread id, or
+   TID_ERROR if the thread cannot be created or the program
+   cannot be loaded. */
 tid_t
-process_execute (const char *file_name) 
+process_execute (const char *cmd_line) 
 {
-  char *fn_copy;
+  struct exec_info exec;
+  char prog_name[16];
+  char *name, *save_ptr;
   tid_t tid;
 
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
-    return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
-
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, execute_thread, fn_copy);
-  if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
+  /* Initialize exec_info.  CMD_LINE stays valid because we wait
+     for the new thread to finish loading. */
+  exec.cmd_line = cmd_line;
+  sema_init (&exec.load_done, 0);
+
+  /* Create thread named after the program. */
+  strlcpy (prog_name, cmd_line, sizeof prog_name);
+  name = strtok_r (prog_name, " ", &save_ptr);
+  tid = thread_create (name != NULL ? name : prog_name, PRI_DEFAULT,
+                       execute_thread, &exec);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&exec.load_done);
+      if (exec.success)
+        list_push_back (&thread_current ()->children,
+                        &exec.wait_status->elem);
+      else
+        tid = TID_ERROR;
+    }
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-execute_thread (void *file_name_)
+execute_thread (void *exec_)
 {
-  char *file_name = file_name_;
+  struct exec_info *exec = exec_;
   struct intr_frame if_;
   bool success;
 
@@ -59,10 +105,16 @@ execute_thread (void *file_name_)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (file_name, &if_.eip, &if_.esp);
+  success = load (exec->cmd_line, &if_.eip, &if_.esp);
+
+  /* Allocate and initialize the wait_status shared with our
+     parent. */
+  if (success)
+    success = (exec->wait_status = create_wait_status ()) != NULL;
 
-  /* If load failed, quit. */
-  palloc_free_page (file_name);
+  /* Notify parent thread.  EXEC is invalid once we do. */
+  exec->success = success;
+  sema_up (&exec->load_done);
   if (!success) 
     thread_exit ();
 
@@ -76,18 +128,168 @@ execute_thread (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Allocates and initializes the running thread's wait_status,
+   which it shares with its parent.  Returns the wait_status, or
+   a null pointer if memory is short. */
+static struct wait_status *
+create_wait_status (void) 
+{
+  struct thread *cur = thread_current ();
+  struct wait_status *cs = cur->wait_status = malloc (sizeof *cs);
+
+  if (cs != NULL) 
+    {
+      lock_init (&cs->lock);
+      cs->ref_cnt = 2;
+      cs->tid = cur->tid;
+      cs->exit_code = -1;
+      sema_init (&cs->dead, 0);
+    }
+  return cs;
+}
+
+/* Data structure shared between process_fork() in the parent
+   and fork_thread() in the child. */
+struct fork_info 
+  {
+    struct thread *parent;              /* Process being forked. */
+    const struct intr_frame *if_;       /* Parent's user registers. */
+    struct semaphore done;              /* "Up"ed when copy complete. */
+    struct wait_status *wait_status;    /* Child process. */
+    bool success;                       /* Process successfully copied? */
+  };
+
+/* Starts a new process that is a copy of the running one, with
+   the same address space contents and open files, which resumes
+   in user mode with the registers in IF_ except that fork()
+   returns 0 in the new process.  Waits for the copy to
+   complete.  Returns the new process's thread id, or TID_ERROR
+   if the thread cannot be created or the process cannot be
+   copied. */
+tid_t
+process_fork (const struct intr_frame *if_) 
+{
+  struct thread *cur = thread_current ();
+  struct fork_info fork;
+  tid_t tid;
+
+  /* FORK stays valid, and we stay put, because we wait for the
+     new thread to finish copying us. */
+  fork.parent = cur;
+  fork.if_ = if_;
+  sema_init (&fork.done, 0);
+
+  tid = thread_create (cur->name, PRI_DEFAULT, fork_thread, &fork);
+  if (tid != TID_ERROR)
+    {
+      sema_down (&fork.done);
+      if (fork.success)
+        list_push_back (&cur->children, &fork.wait_status->elem);
+      else
+        tid = TID_ERROR;
+    }
+  return tid;
+}
+
+/* Gives the running thread a copy of PARENT's address space,
+   executable, and open files.  Returns true if successful,
+   false otherwise. */
+static bool
+copy_process (struct thread *parent) 
+{
+  struct thread *t = thread_current ();
+
+  /* Allocate and activate page directory. */
+  t->pagedir = pagedir_create ();
+  if (t->pagedir == NULL) 
+    return false;
+  process_activate ();
+
+  /* The executable stays unwritable until both processes exit. */
+  t->bin_file = file_dup (parent->bin_file);
+
+#ifdef VM
+  /* Share the parent's pages copy-on-write. */
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL
+      || !hash_init (t->pages, page_hash, page_less, NULL)
+      || !page_fork (parent))
+    return false;
+#else
+  /* Copy every page. */
+  if (!pagedir_dup (t->pagedir, parent->pagedir))
+    return false;
+#endif
+
+  return syscall_fork (parent);
+}
+
+/* A thread function that copies a user process and starts the
+   copy running. */
+static void
+fork_thread (void *fork_)
+{
+  struct fork_info *fork = fork_;
+  struct intr_frame if_ = *fork->if_;
+  bool success;
+
+  success = (copy_process (fork->parent)
+             && (fork->wait_status = create_wait_status ()) != NULL);
+
+  /* Notify parent thread.  FORK is invalid once we do. */
+  fork->success = success;
+  sema_up (&fork->done);
+  if (!success) 
+    thread_exit ();
+
+  /* Return 0 from fork() in the new process, by way of
+     intr_exit, as in execute_thread(). */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Releases one reference to CS and, if it is now unreferenced,
+   frees it. */
+static void
+release_child (struct wait_status *cs) 
+{
+  int new_ref_cnt;
+  
+  lock_acquire (&cs->lock);
+  new_ref_cnt = --cs->ref_cnt;
+  lock_release (&cs->lock);
+
+  if (new_ref_cnt == 0)
+    free (cs);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
    child of the calling process, or if process_wait() has already
    been successfully called for the given TID, returns -1
-   immediately, without waiting.
-
-   This function will be implemented in problem 2-2.  For now, it
-   does nothing. */
+   immediately, without waiting. */
 int
-process_wait (tid_t child_tid UNUSED) 
+process_wait (tid_t child_tid) 
 {
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = list_next (e)) 
+    {
+      struct wait_status *cs = list_entry (e, struct wait_status, elem);
+      if (cs->tid == child_tid) 
+        {
+          int exit_code;
+          list_remove (e);
+          sema_down (&cs->dead);
+          exit_code = cs->exit_code;
+          release_child (cs);
+          return exit_code;
+        }
+    }
   return -1;
 }
 
@@ -96,8 +298,42 @@ void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct list_elem *e, *next;
   uint32_t *pd;
 
+  if (cur->pagedir != NULL)
+    printf ("%s: exit(%d)\n", cur->name, cur->exit_code);
+
+  /* Close open files, then the executable, which allows writes
+     to it again. */
+  syscall_exit ();
+  file_close (cur->bin_file);
+  cur->bin_file = NULL;
+
+  /* Notify parent that we're dead. */
+  if (cur->wait_status != NULL) 
+    {
+      struct wait_status *cs = cur->wait_status;
+      cs->exit_code = cur->exit_code;
+      sema_up (&cs->dead);
+      release_child (cs);
+    }
+
+  /* Free entries of children list. */
+  for (e = list_begin (&cur->children); e != list_end (&cur->children);
+       e = next) 
+    {
+      struct wait_status *cs = list_entry (e, struct wait_status, elem);
+      next = list_remove (e);
+      release_child (cs);
+    }
+
+#ifdef VM
+  /* Destroy the supplemental page table, freeing the frames of
+     the pages that are in memory. */
+  page_exit ();
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
@@ -194,24 +430,27 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
-static bool setup_stack (void **esp);
+static bool setup_stack (const char *cmd_line, void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
-   Stores the executable's entry point into *EIP
-   and its initial stack pointer into *ESP.
+/* Loads an ELF executable from the file named by the first word
+   of CMD_LINE into the current thread, passing it the words of
+   CMD_LINE as arguments.  Stores the executable's entry point
+   into *EIP and its initial stack pointer into *ESP.
    Returns true if successful, false otherwise. */
-bool
-load (const char *file_name, void (**eip) (void), void **esp) 
+static bool
+load (const char *cmd_line, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
+  char file_name[NAME_MAX + 2];
   struct Elf32_Ehdr ehdr;
   struct file *file = NULL;
   off_t file_ofs;
   bool success = false;
+  char *cp;
   int i;
 
   /* Allocate and activate page directory. */
@@ -220,13 +459,30 @@ load (const char *file_name, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
-  /* Open executable file. */
-  file = filesys_open (file_name);
+#ifdef VM
+  /* Create supplemental page table. */
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL || !hash_init (t->pages, page_hash, page_less, NULL))
+    goto done;
+#endif
+
+  /* Extract file_name from command line. */
+  while (*cmd_line == ' ')
+    cmd_line++;
+  strlcpy (file_name, cmd_line, sizeof file_name);
+  cp = strchr (file_name, ' ');
+  if (cp != NULL)
+    *cp = '\0';
+
+  /* Open executable file.  It stays open, and unwritable, until
+     the process exits. */
+  t->bin_file = file = filesys_open (file_name);
   if (file == NULL) 
     {
       printf ("load: %s: open failed\n", file_name);
       goto done; 
     }
+  file_deny_write (file);
 
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
@@ -301,7 +557,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
     }
 
   /* Set up stack. */
-  if (!setup_stack (esp))
+  if (!setup_stack (cmd_line, esp))
     goto done;
 
   /* Start address. */
@@ -310,14 +566,16 @@ load (const char *file_name, void (**eip) (void), void **esp)
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
+  /* We arrive here whether the load is successful or not.
+     process_exit() closes the executable. */
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -376,6 +634,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and each is read in when it is
+   first touched.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -395,6 +657,18 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from. */
+      struct page *p = page_allocate (upage, !writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0) 
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -414,35 +688,129 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
   return true;
 }
 
-/* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+/* Pushes the SIZE bytes in BUF onto the stack in KPAGE, whose
+   page-relative stack pointer is *OFS, and then adjusts *OFS
+   appropriately.  The bytes pushed are rounded to a 32-bit
+   boundary.
+
+   If successful, returns a pointer to the newly pushed object.
+   On failure, returns a null pointer. */
+static void *
+push (uint8_t *kpage, size_t *ofs, const void *buf, size_t size) 
+{
+  size_t padsize = ROUND_UP (size, sizeof (uint32_t));
+  if (*ofs < padsize)
+    return NULL;
+
+  *ofs -= padsize;
+  memcpy (kpage + *ofs + (padsize - size), buf, size);
+  return kpage + *ofs + (padsize - size);
+}
+
+/* Reverses the order of the CNT pointers in ARRAY. */
+static void
+reverse (int cnt, char **array) 
+{
+  for (; cnt > 1; cnt -= 2, array++) 
+    {
+      char *tmp = array[0];
+      array[0] = array[cnt - 1];
+      array[cnt - 1] = tmp;
+    }
+}
+
+/* Sets up command line arguments in KPAGE, which will be mapped
+   to UPAGE in user space.  The command line arguments are taken
+   from CMD_LINE, separated by spaces.  Sets *ESP to the initial
+   stack pointer for the process. */
 static bool
-setup_stack (void **esp) 
+init_cmd_line (uint8_t *kpage, uint8_t *upage, const char *cmd_line,
+               void **esp) 
 {
+  size_t ofs = PGSIZE;
+  char *const null = NULL;
+  char *cmd_line_copy;
+  char *karg, *saveptr;
+  int argc;
+  char **argv;
+
+  /* Push command line string. */
+  cmd_line_copy = push (kpage, &ofs, cmd_line, strlen (cmd_line) + 1);
+  if (cmd_line_copy == NULL)
+    return false;
+
+  if (push (kpage, &ofs, &null, sizeof null) == NULL)
+    return false;
+
+  /* Parse command line into arguments
+     and push them in reverse order. */
+  argc = 0;
+  for (karg = strtok_r (cmd_line_copy, " ", &saveptr); karg != NULL;
+       karg = strtok_r (NULL, " ", &saveptr))
+    {
+      void *uarg = upage + (karg - (char *) kpage);
+      if (push (kpage, &ofs, &uarg, sizeof uarg) == NULL)
+        return false;
+      argc++;
+    }
+
+  /* Reverse the order of the command line arguments. */
+  argv = (char **) (upage + ofs);
+  reverse (argc, (char **) (kpage + ofs));
+
+  /* Push argv, argc, "return address". */
+  if (push (kpage, &ofs, &argv, sizeof argv) == NULL
+      || push (kpage, &ofs, &argc, sizeof argc) == NULL
+      || push (kpage, &ofs, &null, sizeof null) == NULL)
+    return false;
+
+  /* Set initial stack pointer. */
+  *esp = upage + ofs;
+  return true;
+}
+
+/* Create a minimal stack by mapping a page at the top of user
+   virtual memory.  Fills in the page using CMD_LINE
+   and sets *ESP to the stack pointer. */
+static bool
+setup_stack (const char *cmd_line, void **esp) 
+{
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   uint8_t *kpage;
   bool success = false;
 
+#ifdef VM
+  if (page_allocate (upage, false) != NULL && page_lock (upage, true)) 
+    {
+      kpage = pagedir_get_page (thread_current ()->pagedir, upage);
+      success = init_cmd_line (kpage, upage, cmd_line, esp);
+      page_unlock (upage);
+    }
+#else
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
-      if (success)
-        *esp = PHYS_BASE;
+      if (install_page (upage, kpage, true))
+        success = init_cmd_line (kpage, upage, cmd_line, esp);
       else
         palloc_free_page (kpage);
     }
+#endif
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -462,3 +830,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -1,20 +1,862 @@
 #include "userprog/syscall.h"
+#include <round.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/usercopy.h"
+#include "devices/input.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
-static void syscall_handler (struct intr_frame *);
+/* A system call's implementation.  Each takes the call's
+   arguments as it declares them, but all are called through
+   this type with three, of which the callee uses the first
+   ARG_CNT (see struct syscall).  Returns the value to give back
+   to the user program in %eax. */
+typedef int syscall_function (int, int, int);
+
+/* A system call.  FUNC is stored as a generic function pointer
+   and cast to syscall_function when called. */
+struct syscall
+  {
+    size_t arg_cnt;             /* Number of arguments. */
+    void (*func) (void);        /* Implementation. */
+  };
+
+/* Initializer for a struct syscall. */
+#define SYSCALL(ARG_CNT, FUNC) {ARG_CNT, (void (*) (void)) FUNC}
+
+static int sys_halt (void);
+static int sys_exit (int status);
+static int sys_exec (const char *ucmd_line);
+static int sys_wait (tid_t);
+static int sys_create (const char *ufile, unsigned initial_size);
+static int sys_remove (const char *ufile);
+static int sys_open (const char *ufile);
+static int sys_filesize (int handle);
+static int sys_read (int handle, void *udst, unsigned size);
+static int sys_write (int handle, const void *usrc, unsigned size);
+static int sys_seek (int handle, unsigned position);
+static int sys_tell (int handle);
+static int sys_close (int handle);
+#ifdef VM
+static int sys_mmap (int handle, void *addr);
+static int sys_munmap (int mapping);
+#endif
+static int sys_chdir (const char *udir);
+static int sys_mkdir (const char *udir);
+static int sys_readdir (int handle, char *uname);
+static int sys_isdir (int handle);
+static int sys_inumber (int handle);
+static int sys_readdir_many (int handle, struct dirent *uentries,
+                             unsigned max);
+static int sys_fsync (int handle);
+static int sys_sync (void);
+static int sys_reflink (const char *ufile, const char *unew_file);
+static int sys_fork (void);
+
+/* Table of system calls, indexed by system call number.  Calls
+   without an entry, such as mmap and munmap without virtual
+   memory, kill the process that makes them. */
+static const struct syscall syscall_table[] =
+  {
+    [SYS_HALT] = SYSCALL (0, sys_halt),
+    [SYS_EXIT] = SYSCALL (1, sys_exit),
+    [SYS_EXEC] = SYSCALL (1, sys_exec),
+    [SYS_WAIT] = SYSCALL (1, sys_wait),
+    [SYS_CREATE] = SYSCALL (2, sys_create),
+    [SYS_REMOVE] = SYSCALL (1, sys_remove),
+    [SYS_OPEN] = SYSCALL (1, sys_open),
+    [SYS_FILESIZE] = SYSCALL (1, sys_filesize),
+    [SYS_READ] = SYSCALL (3, sys_read),
+    [SYS_WRITE] = SYSCALL (3, sys_write),
+    [SYS_SEEK] = SYSCALL (2, sys_seek),
+    [SYS_TELL] = SYSCALL (1, sys_tell),
+    [SYS_CLOSE] = SYSCALL (1, sys_close),
+#ifdef VM
+    [SYS_MMAP] = SYSCALL (2, sys_mmap),
+    [SYS_MUNMAP] = SYSCALL (1, sys_munmap),
+#endif
+    [SYS_CHDIR] = SYSCALL (1, sys_chdir),
+    [SYS_MKDIR] = SYSCALL (1, sys_mkdir),
+    [SYS_READDIR] = SYSCALL (2, sys_readdir),
+    [SYS_ISDIR] = SYSCALL (1, sys_isdir),
+    [SYS_INUMBER] = SYSCALL (1, sys_inumber),
+    [SYS_READDIR_MANY] = SYSCALL (3, sys_readdir_many),
+    [SYS_FSYNC] = SYSCALL (1, sys_fsync),
+    [SYS_SYNC] = SYSCALL (0, sys_sync),
+    [SYS_REFLINK] = SYSCALL (2, sys_reflink),
+    [SYS_FORK] = SYSCALL (0, sys_fork),
+  };
+
+/* Number of entries in syscall_table. */
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
 
 void
-syscall_init (void) 
+syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* System call handler, for both "int $0x30" and SYSENTER (see
+   sysenter.S).  The user program pushes the arguments and then
+   the system call number, so the number is at the top of the
+   user stack and the arguments follow it.  Any bad pointer
+   among them kills the process. */
+void
+syscall_handler (struct intr_frame *f)
+{
+  const struct syscall *sc;
+  unsigned number;
+  int args[3];
+
+  /* Record the frame, which has the user's registers, for
+     sys_fork() and for page faults taken on the user's behalf. */
+  thread_current ()->syscall_frame = f;
+
+  /* Get the system call. */
+  if (!copy_from_user (&number, f->esp, sizeof number)
+      || number >= SYSCALL_CNT
+      || syscall_table[number].func == NULL)
+    thread_exit ();
+  sc = &syscall_table[number];
+
+  /* Get the system call arguments, only as many as it takes. */
+  ASSERT (sc->arg_cnt <= sizeof args / sizeof *args);
+  if (!copy_from_user (args, (uint32_t *) f->esp + 1,
+                       sizeof *args * sc->arg_cnt))
+    thread_exit ();
+
+  /* Execute the system call, and set the return value. */
+  f->eax = ((syscall_function *) sc->func) (args[0], args[1], args[2]);
+}
+
+/* Returns the kernel address through which the kernel can
+   access user address UADDR, after checking that the process
+   may read UADDR, and write it too if WRITABLE is true.
+   Returns a null pointer if it may not.  With virtual memory,
+   also locks UADDR's page into memory, which the caller must
+   undo with unpin_user_range(). */
+static uint8_t *
+user_to_kernel (uint8_t *uaddr, bool writable)
+{
+  uint8_t byte;
+
+  /* Access UADDR just as the process would, letting a bad
+     address fault.  Writing back the byte just read leaves the
+     page unchanged. */
+  if (!copy_from_user (&byte, uaddr, 1)
+      || (writable && !copy_to_user (uaddr, &byte, 1)))
+    return NULL;
+#ifdef VM
+  if (!page_lock (uaddr, writable))
+    return NULL;
+#endif
+  return pagedir_get_page (thread_current ()->pagedir, uaddr);
+}
+
+/* Unlocks the pages spanned by the CNT > 0 bytes starting at
+   user address UADDR, which user_to_kernel() locked. */
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+unpin_user_range (uint8_t *uaddr UNUSED, size_t cnt UNUSED)
+{
+#ifdef VM
+  uint8_t *upage;
+
+  for (upage = pg_round_down (uaddr); upage < uaddr + cnt; upage += PGSIZE)
+    page_unlock (upage);
+#endif
+}
+
+/* Translates the SIZE > 0 bytes of user memory starting at
+   UADDR into kernel addresses, checking access as
+   user_to_kernel() does.  Returns the kernel address of UADDR
+   and stores in *CNT the number of bytes from there that are
+   also contiguous in kernel memory, which is at least as many
+   as remain in UADDR's page.  Thus, the kernel can access
+   user buffers in place, in runs as long as the pages behind
+   them happen to be adjacent.  Kills the process if UADDR is
+   bad.  The caller must pass the result to unpin_user_range()
+   when it is done with it. */
+static uint8_t *
+user_range_to_kernel (uint8_t *uaddr, size_t size, bool writable,
+                      size_t *cnt)
+{
+  uint8_t *kaddr = user_to_kernel (uaddr, writable);
+  size_t run = PGSIZE - pg_ofs (uaddr);
+
+  if (kaddr == NULL)
+    thread_exit ();
+
+  /* Extend the run.  A bad page just ends it here, so that the
+     caller's next call kills the process without any pages
+     locked. */
+  while (run < size) 
+    {
+      uint8_t *next = user_to_kernel (uaddr + run, writable);
+      if (next != kaddr + run) 
+        {
+          if (next != NULL)
+            unpin_user_range (uaddr + run, 1);
+          break;
+        }
+      run += PGSIZE;
+    }
+  *cnt = run < size ? run : size;
+  return kaddr;
+}
+
+/* Copies the file name at user address UFILE into NAME.  Kills
+   the process if UFILE is a bad pointer.  Returns false if the
+   name is too long to name any file. */
+static bool
+copy_file_name (char name[NAME_MAX + 2], const char *ufile)
 {
-  printf ("system call!\n");
+  int len = strncpy_from_user (name, ufile, NAME_MAX + 2);
+  if (len < 0)
+    thread_exit ();
+  return len <= NAME_MAX;
+}
+
+/* Halt system call. */
+static int
+sys_halt (void)
+{
+  power_off ();
+}
+
+/* Exit system call. */
+static int
+sys_exit (int exit_code)
+{
+  thread_current ()->exit_code = exit_code;
   thread_exit ();
+  NOT_REACHED ();
+}
+
+/* Exec system call. */
+static int
+sys_exec (const char *ucmd_line)
+{
+  tid_t tid;
+  char *cmd_line;
+  int len;
+
+  cmd_line = palloc_get_page (0);
+  if (cmd_line == NULL)
+    return -1;
+  len = strncpy_from_user (cmd_line, ucmd_line, PGSIZE);
+  if (len < 0)
+    {
+      palloc_free_page (cmd_line);
+      thread_exit ();
+    }
+  tid = len < PGSIZE ? process_execute (cmd_line) : TID_ERROR;
+  palloc_free_page (cmd_line);
+
+  return tid;
+}
+
+/* Wait system call. */
+static int
+sys_wait (tid_t child)
+{
+  return process_wait (child);
+}
+
+/* Create system call. */
+static int
+sys_create (const char *ufile, unsigned initial_size)
+{
+  char name[NAME_MAX + 2];
+
+  return (copy_file_name (name, ufile)
+          && filesys_create (name, initial_size));
+}
+
+/* Remove system call. */
+static int
+sys_remove (const char *ufile)
+{
+  char name[NAME_MAX + 2];
+
+  return copy_file_name (name, ufile) && filesys_remove (name);
+}
+
+/* Maximum number of files and directories that a process may
+   have open at once, not counting the console. */
+size_t fd_max = 128;
+
+/* A file descriptor, for binding a file handle to a file or a
+   directory.  A free descriptor has neither. */
+struct file_descriptor
+  {
+    struct file *file;          /* File, or null for a directory. */
+    struct dir *dir;            /* Directory, or null for a file. */
+  };
+
+/* Each process has a table of file descriptors, FDS in struct
+   thread, indexed by file handle minus FIRST_HANDLE, so looking
+   up a handle takes constant time.  The table starts out empty
+   and doubles in size whenever it fills up, up to fd_max
+   entries.  FD_USED is a bitmap of the descriptors in use, with
+   a bit per descriptor, so that opening a file can find the
+   lowest free handle by scanning it a word at a time. */
+
+/* Handles 0 and 1 are the console, so the table starts at 2. */
+#define FIRST_HANDLE 2
+
+/* Descriptors per word of FD_USED.  The table always has a
+   multiple of this many descriptors. */
+#define FD_BITS 32
+
+/* Allocates the lowest free descriptor in the running process's
+   table, growing the table if it is full, and returns its
+   index.  Returns -1 if the process has fd_max files open or if
+   memory is short. */
+static int
+alloc_fd (void)
+{
+  struct thread *cur = thread_current ();
+  size_t new_cnt, i;
+  void *fds, *used;
+
+  /* Find a free descriptor. */
+  for (i = 0; i < cur->fd_cnt / FD_BITS; i++)
+    if (cur->fd_used[i] != UINT32_MAX)
+      {
+        int bit = __builtin_ctz (~cur->fd_used[i]);
+        if (i * FD_BITS + bit >= fd_max)
+          return -1;
+        cur->fd_used[i] |= 1u << bit;
+        return i * FD_BITS + bit;
+      }
+
+  /* The table is full.  Double its size. */
+  new_cnt = cur->fd_cnt > 0 ? cur->fd_cnt * 2 : FD_BITS;
+  if (new_cnt > ROUND_UP (fd_max, FD_BITS))
+    new_cnt = ROUND_UP (fd_max, FD_BITS);
+  if (new_cnt <= cur->fd_cnt)
+    return -1;
+  fds = realloc (cur->fds, new_cnt * sizeof *cur->fds);
+  if (fds == NULL)
+    return -1;
+  cur->fds = fds;
+  used = realloc (cur->fd_used, new_cnt / FD_BITS * sizeof *cur->fd_used);
+  if (used == NULL)
+    {
+      /* FDS has grown, but FD_CNT still describes only its old
+         entries, so the extra room just goes unused until the
+         next try grows it again. */
+      return -1;
+    }
+  cur->fd_used = used;
+  memset (cur->fds + cur->fd_cnt, 0,
+          (new_cnt - cur->fd_cnt) * sizeof *cur->fds);
+  memset (cur->fd_used + cur->fd_cnt / FD_BITS, 0,
+          (new_cnt - cur->fd_cnt) / FD_BITS * sizeof *cur->fd_used);
+  i = cur->fd_cnt;
+  cur->fd_cnt = new_cnt;
+
+  /* The first new descriptor is free. */
+  if (i >= fd_max)
+    return -1;
+  cur->fd_used[i / FD_BITS] |= 1;
+  return i;
+}
+
+/* Frees descriptor IDX in the running process's table, closing
+   what it refers to. */
+static void
+free_fd (size_t idx)
+{
+  struct thread *cur = thread_current ();
+  struct file_descriptor *fd = &cur->fds[idx];
+
+  file_close (fd->file);
+  dir_close (fd->dir);
+  fd->file = NULL;
+  fd->dir = NULL;
+  cur->fd_used[idx / FD_BITS] &= ~(1u << idx % FD_BITS);
+}
+
+/* Open system call.  The file system has a single directory,
+   which may be opened as "/" for reading its entries. */
+static int
+sys_open (const char *ufile)
+{
+  char name[NAME_MAX + 2];
+  struct file_descriptor *fd;
+  int idx;
+
+  if (!copy_file_name (name, ufile))
+    return -1;
+
+  idx = alloc_fd ();
+  if (idx < 0)
+    return -1;
+  fd = &thread_current ()->fds[idx];
+  if (!strcmp (name, "/"))
+    fd->dir = dir_open_root ();
+  else
+    fd->file = filesys_open (name);
+  if (fd->file == NULL && fd->dir == NULL)
+    {
+      free_fd (idx);
+      return -1;
+    }
+  return idx + FIRST_HANDLE;
+}
+
+/* Returns the file descriptor associated with the given handle,
+   or a null pointer if HANDLE is not open. */
+static struct file_descriptor *
+lookup_fd (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct file_descriptor *fd;
+  size_t idx = (unsigned) handle - FIRST_HANDLE;
+
+  if (idx >= cur->fd_cnt)
+    return NULL;
+  fd = &cur->fds[idx];
+  return fd->file != NULL || fd->dir != NULL ? fd : NULL;
+}
+
+/* Returns the file associated with the given handle, or a null
+   pointer if HANDLE is not open or refers to a directory. */
+static struct file *
+lookup_file (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? fd->file : NULL;
+}
+
+/* Returns the directory associated with the given handle, or a
+   null pointer if HANDLE is not open or refers to a file. */
+static struct dir *
+lookup_dir (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  return fd != NULL ? fd->dir : NULL;
+}
+
+/* Filesize system call. */
+static int
+sys_filesize (int handle)
+{
+  struct file *file = lookup_file (handle);
+  return file != NULL ? file_length (file) : -1;
+}
+
+/* Read system call.  Reads go straight into the user's buffer,
+   so a large, aligned read goes from disk to the user's pages
+   without a copy. */
+static int
+sys_read (int handle, void *udst_, unsigned size)
+{
+  uint8_t *udst = udst_;
+  struct file *file;
+  int bytes_read = 0;
+
+  /* Handle keyboard reads. */
+  if (handle == STDIN_FILENO)
+    {
+      for (; (unsigned) bytes_read < size; bytes_read++)
+        {
+          uint8_t c = input_getc ();
+          if (!copy_to_user (udst + bytes_read, &c, 1))
+            thread_exit ();
+        }
+      return bytes_read;
+    }
+
+  /* Handle all other reads. */
+  file = lookup_file (handle);
+  if (file == NULL)
+    return -1;
+  while (size > 0)
+    {
+      size_t cnt;
+      uint8_t *kdst = user_range_to_kernel (udst, size, true, &cnt);
+      off_t retval = file_read (file, kdst, cnt);
+
+      unpin_user_range (udst, cnt);
+      bytes_read += retval;
+      if (retval != (off_t) cnt)
+        break;
+      udst += cnt;
+      size -= cnt;
+    }
+  return bytes_read;
+}
+
+/* Write system call. */
+static int
+sys_write (int handle, const void *usrc_, unsigned size)
+{
+  uint8_t *usrc = (uint8_t *) usrc_;
+  struct file *file = NULL;
+  int bytes_written = 0;
+
+  /* Lookup up file descriptor. */
+  if (handle != STDOUT_FILENO)
+    {
+      file = lookup_file (handle);
+      if (file == NULL)
+        return -1;
+    }
+
+  while (size > 0)
+    {
+      size_t cnt;
+      uint8_t *ksrc = user_range_to_kernel (usrc, size, false, &cnt);
+      off_t retval;
+
+      /* Do the write. */
+      if (handle == STDOUT_FILENO)
+        {
+          putbuf ((char *) ksrc, cnt);
+          retval = cnt;
+        }
+      else
+        retval = file_write (file, ksrc, cnt);
+      unpin_user_range (usrc, cnt);
+
+      bytes_written += retval;
+      if (retval != (off_t) cnt)
+        break;
+      usrc += cnt;
+      size -= cnt;
+    }
+  return bytes_written;
+}
+
+/* Seek system call. */
+static int
+sys_seek (int handle, unsigned position)
+{
+  struct file *file = lookup_file (handle);
+  if (file != NULL && (off_t) position >= 0)
+    file_seek (file, position);
+  return 0;
+}
+
+/* Tell system call. */
+static int
+sys_tell (int handle)
+{
+  struct file *file = lookup_file (handle);
+  return file != NULL ? file_tell (file) : -1;
+}
+
+/* Close system call. */
+static int
+sys_close (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+  if (fd != NULL)
+    free_fd (fd - thread_current ()->fds);
+  return 0;
+}
+
+#ifdef VM
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* `mappings' list element. */
+    int handle;                 /* Mapping id. */
+    struct file *file;          /* File. */
+    uint8_t *base;              /* Start of memory mapping. */
+    size_t page_cnt;            /* Number of pages mapped. */
+  };
+
+/* Returns the running process's mapping with the given HANDLE,
+   or a null pointer if there is none. */
+static struct mapping *
+lookup_mapping (int handle)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->handle == handle)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes mapping M from the running process's address space,
+   writing its modified pages back to the file, and frees it. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  list_remove (&m->elem);
+  for (i = 0; i < m->page_cnt; i++)
+    page_deallocate (m->base + PGSIZE * i);
+  file_close (m->file);
+  free (m);
+}
+
+/* Mmap system call.  Maps the file open as HANDLE at ADDR, which
+   must be page-aligned and not overlap any other page of the
+   process.  Pages are read from the file when first touched,
+   and modified pages are written back to it when they are
+   evicted or unmapped. */
+static int
+sys_mmap (int handle, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct file *file = lookup_file (handle);
+  struct mapping *m;
+  off_t length, ofs;
+
+  if (file == NULL || addr == NULL || pg_ofs (addr) != 0)
+    return -1;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return -1;
+  m->handle = cur->next_mapping++;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return -1;
+    }
+  m->base = addr;
+  m->page_cnt = 0;
+  list_push_front (&cur->mappings, &m->elem);
+
+  length = file_length (m->file);
+  for (ofs = 0; ofs < length; ofs += PGSIZE)
+    {
+      struct page *p = page_allocate (m->base + ofs, false);
+      if (p == NULL)
+        break;
+      p->private = false;
+      p->file = m->file;
+      p->file_offset = ofs;
+      p->file_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      m->page_cnt++;
+    }
+  if (length == 0 || ofs < length)
+    {
+      unmap (m);
+      return -1;
+    }
+  return m->handle;
+}
+
+/* Munmap system call. */
+static int
+sys_munmap (int mapping)
+{
+  struct mapping *m = lookup_mapping (mapping);
+  if (m != NULL)
+    unmap (m);
+  return 0;
+}
+#endif /* VM */
+
+/* Chdir system call.  The root is the only directory, so
+   changing to it is all that can succeed. */
+static int
+sys_chdir (const char *udir)
+{
+  char name[NAME_MAX + 2];
+
+  return copy_file_name (name, udir) && !strcmp (name, "/");
+}
+
+/* Mkdir system call.  The file system has a single directory,
+   so this always fails. */
+static int
+sys_mkdir (const char *udir)
+{
+  char name[NAME_MAX + 2];
+
+  copy_file_name (name, udir);
+  return false;
+}
+
+/* Readdir system call. */
+static int
+sys_readdir (int handle, char *uname)
+{
+  struct dir *dir = lookup_dir (handle);
+  char name[NAME_MAX + 1];
+
+  if (dir == NULL || !dir_readdir (dir, name))
+    return false;
+  if (!copy_to_user (uname, name, strlen (name) + 1))
+    thread_exit ();
+  return true;
+}
+
+/* Isdir system call. */
+static int
+sys_isdir (int handle)
+{
+  return lookup_dir (handle) != NULL;
+}
+
+/* Inumber system call. */
+static int
+sys_inumber (int handle)
+{
+  struct file_descriptor *fd = lookup_fd (handle);
+
+  if (fd == NULL)
+    return -1;
+  return inode_get_inumber (fd->file != NULL
+                            ? file_get_inode (fd->file)
+                            : dir_get_inode (fd->dir));
+}
+
+/* Readdir_many system call.  Entries are read a batch at a time
+   and copied out to the user's array. */
+static int
+sys_readdir_many (int handle, struct dirent *uentries, unsigned max)
+{
+  struct dir *dir = lookup_dir (handle);
+  struct dirent batch[8];
+  unsigned cnt = 0;
+
+  if (dir == NULL)
+    return -1;
+  while (cnt < max)
+    {
+      size_t want = max - cnt < 8 ? max - cnt : 8;
+      size_t got = dir_readdir_many (dir, batch, want);
+
+      if (!copy_to_user (uentries + cnt, batch, got * sizeof *batch))
+        thread_exit ();
+      cnt += got;
+      if (got < want)
+        break;
+    }
+  return cnt;
+}
+
+/* Fsync system call. */
+static int
+sys_fsync (int handle)
+{
+  struct file *file = lookup_file (handle);
+  return file != NULL && file_sync (file);
+}
+
+/* Sync system call. */
+static int
+sys_sync (void)
+{
+  filesys_sync ();
+  return 0;
+}
+
+/* Reflink system call. */
+static int
+sys_reflink (const char *ufile, const char *unew_file)
+{
+  char name[NAME_MAX + 2], new_name[NAME_MAX + 2];
+
+  return (copy_file_name (name, ufile)
+          && copy_file_name (new_name, unew_file)
+          && filesys_clone (name, new_name));
+}
+
+/* Fork system call. */
+static int
+sys_fork (void)
+{
+  return process_fork (thread_current ()->syscall_frame);
+}
+
+/* Gives the running thread a copy of PARENT's file descriptor
+   table, whose entries refer to the same open files and
+   directories as PARENT's.  Returns true if successful, false
+   if memory is short. */
+static bool
+copy_fds (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  size_t used_size = parent->fd_cnt / FD_BITS * sizeof *parent->fd_used;
+  size_t i;
+
+  if (parent->fd_cnt == 0)
+    return true;
+  cur->fds = malloc (parent->fd_cnt * sizeof *cur->fds);
+  cur->fd_used = malloc (used_size);
+  if (cur->fds == NULL || cur->fd_used == NULL)
+    {
+      free (cur->fds);
+      free (cur->fd_used);
+      cur->fds = NULL;
+      cur->fd_used = NULL;
+      return false;
+    }
+  memcpy (cur->fd_used, parent->fd_used, used_size);
+  cur->fd_cnt = parent->fd_cnt;
+
+  for (i = 0; i < cur->fd_cnt; i++)
+    {
+      const struct file_descriptor *pfd = &parent->fds[i];
+      struct file_descriptor *fd = &cur->fds[i];
+
+      fd->file = pfd->file != NULL ? file_dup (pfd->file) : NULL;
+      fd->dir = pfd->dir != NULL ? dir_reopen (pfd->dir) : NULL;
+    }
+  return true;
+}
+
+/* Gives the running thread a copy of PARENT's open files.
+   Memory-mapped files are not inherited (see page_fork()).
+   Returns true if successful, false if memory is short. */
+bool
+syscall_fork (struct thread *parent)
+{
+  return copy_fds (parent);
+}
+
+/* On thread exit, close all open file handles and, with virtual
+   memory, unmap all memory-mapped files. */
+void
+syscall_exit (void)
+{
+  struct thread *cur = thread_current ();
+  size_t i;
+
+#ifdef VM
+  while (!list_empty (&cur->mappings))
+    unmap (list_entry (list_front (&cur->mappings), struct mapping, elem));
+#endif
+
+  for (i = 0; i < cur->fd_cnt; i++)
+    if (cur->fd_used[i / FD_BITS] & (1u << i % FD_BITS))
+      free_fd (i);
+  free (cur->fds);
+  free (cur->fd_used);
+  cur->fds = NULL;
+  cur->fd_used = NULL;
+  cur->fd_cnt = 0;
 }
@@ -1,6 +1,18 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+struct intr_frame;
+struct thread;
+
+/* Maximum number of files a process may have open at once. */
+extern size_t fd_max;
+
 void syscall_init (void);
+void syscall_handler (struct intr_frame *);
+bool syscall_fork (struct thread *parent);
+void syscall_exit (void);
 
 #endif /* userprog/syscall.h */
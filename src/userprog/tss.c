@@ -1,5 +1,6 @@
 #include "userprog/tss.h"
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include "userprog/gdt.h"
 #include "threads/palloc.h"
@@ -74,6 +75,18 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* Model-specific registers that configure SYSENTER.  See
+   [IA32-v2b] "SYSENTER--Fast System Call". */
+#define MSR_SYSENTER_CS 0x174   /* Kernel code selector. */
+#define MSR_SYSENTER_ESP 0x175  /* Kernel stack pointer. */
+#define MSR_SYSENTER_EIP 0x176  /* Kernel entry point. */
+
+/* Fast system call entry, in sysenter.S. */
+void sysenter_entry (void);
+
+static bool cpu_has_sysenter (void);
+static void wrmsr (uint32_t msr, uint32_t value);
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -85,6 +98,19 @@ tss_init (void)
   tss->esp0 = ptov(0x20000);
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
+
+  /* Let user programs enter the kernel with SYSENTER too.
+     SYSENTER loads a fixed stack pointer rather than consulting
+     the TSS, so we point it at esp0 and sysenter_entry loads the
+     real stack pointer from there.  SYSENTER derives the kernel
+     stack segment and SYSEXIT the user segments from the kernel
+     code selector, which the GDT's layout in gdt.h allows. */
+  if (cpu_has_sysenter ())
+    {
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_ESP, (uint32_t) &tss->esp0);
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+    }
 }
 
 /* Returns the kernel TSS. */
@@ -102,3 +128,20 @@ tss_set_esp0 (uint8_t *esp0)
   ASSERT (tss != NULL);
   tss->esp0 = esp0;
 }
+
+/* Returns true if the CPU supports SYSENTER and SYSEXIT. */
+static bool
+cpu_has_sysenter (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1u << 11)) != 0;
+}
+
+/* Writes VALUE to model-specific register MSR. */
+static void
+wrmsr (uint32_t msr, uint32_t value) 
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
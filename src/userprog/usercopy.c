@@ -0,0 +1,92 @@
+#include "userprog/usercopy.h"
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+
+/* Copying between kernel and user memory.
+
+   System calls access user memory directly through the user
+   process's page table.  Rather than walking the page table to
+   check each user pointer before using it, the kernel checks
+   only that the pointer lies below PHYS_BASE and then lets the
+   access fault if the page is not mapped or, for writes, is
+   read-only.  The accesses are made by the routines in
+   usercopy-stubs.S; page_fault() passes faults in those routines
+   to usercopy_fixup(), which makes the routine return failure
+   instead of treating the fault as a kernel bug.  The common
+   case, a good pointer, thus costs no more than a memcpy(). */
+
+/* Routines in usercopy-stubs.S. */
+extern uint8_t usercopy_begin[], usercopy_end[];
+bool usercopy_raw (void *dst, const void *src, size_t size);
+int usercopy_str (char *dst, const char *src, size_t size);
+
+/* Returns true if the SIZE bytes starting at UADDR all lie in
+   user virtual memory. */
+static bool
+is_user_range (const void *uaddr, size_t size)
+{
+  return (is_user_vaddr (uaddr)
+          && size <= (size_t) ((const uint8_t *) PHYS_BASE
+                               - (const uint8_t *) uaddr));
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns true if successful, false if USRC is not a valid
+   user range. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size)
+{
+  return is_user_range (usrc, size) && usercopy_raw (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Returns true if successful, false if UDST is not a
+   valid, writable user range. */
+bool
+copy_to_user (void *udst, const void *src, size_t size)
+{
+  return is_user_range (udst, size) && usercopy_raw (udst, src, size);
+}
+
+/* Copies the null-terminated string at user address USRC into
+   the SIZE-byte kernel buffer DST.  Returns the length of the
+   string, not counting the null terminator, if it fits in DST.
+   Returns SIZE if it does not fit, in which case DST is not
+   null-terminated.  Returns -1 if USRC is not a valid user
+   string. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size)
+{
+  size_t limit;
+  int cnt;
+
+  if (!is_user_vaddr (usrc))
+    return -1;
+
+  /* Don't let the string run into kernel memory. */
+  limit = (const char *) PHYS_BASE - usrc;
+  cnt = usercopy_str (dst, usrc, size < limit ? size : limit);
+  if (cnt < 0)
+    return -1;
+  else if (cnt > 0 && dst[cnt - 1] == '\0')
+    return cnt - 1;
+  else
+    return (size_t) cnt < size ? -1 : (int) size;
+}
+
+/* Called by the page fault handler for a fault in kernel mode,
+   described by F.  If the fault happened in one of the routines
+   that access user memory, arranges for it to return failure
+   and returns true.  Otherwise, returns false. */
+bool
+usercopy_fixup (struct intr_frame *f)
+{
+  uint8_t *eip = (uint8_t *) f->eip;
+
+  if (eip < usercopy_begin || eip >= usercopy_end)
+    return false;
+  f->eip = (void (*) (void)) f->eax;
+  f->eax = 0;
+  return true;
+}
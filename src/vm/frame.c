@@ -0,0 +1,383 @@
+#include "vm/frame.h"
+#include <stdio.h>
+#include "vm/page.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The frame table.
+
+   At boot, frame_init() takes every page in the user pool and
+   records it here, so that from then on user pages come only
+   from frame_alloc_and_lock().  When every frame is in use, a
+   victim is chosen with the clock algorithm: the hand sweeps
+   the table, giving each frame whose page has been accessed
+   since the last sweep a second chance by clearing its accessed
+   bit, and evicts the first frame whose page has not.
+
+   Each frame has a lock.  Whoever holds it may change the
+   frame's pages and their contents; holding it also keeps the
+   frame from being evicted, which is how the kernel pins a
+   user page while it accesses it directly.
+
+   A frame usually holds one process's page.  Frames of
+   read-only file data, which is to say executable text, are
+   also entered in the share table, keyed by the file's inode
+   sector and the offset of the data, so that every process
+   running the same executable maps the same frames.  Such a
+   frame is freed when the last of its pages is, and evicting
+   it unmaps it from all of them.  Lock ordering: a frame's lock
+   is acquired before share_lock. */
+static struct frame *frames;
+static size_t frame_cnt;
+
+static struct lock scan_lock;   /* Serializes frame allocation. */
+static size_t hand;             /* Clock hand, an index into FRAMES. */
+
+static struct hash share_table; /* Shared frames. */
+static struct lock share_lock;  /* Protects share_table. */
+
+/* Number of frames evicted, and of page faults satisfied by a
+   frame already in the share table, since boot. */
+static long long evict_cnt;
+static long long share_cnt;
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+/* Initialize the frame table. */
+void
+frame_init (void) 
+{
+  void *base;
+
+  lock_init (&scan_lock);
+  lock_init (&share_lock);
+  hash_init (&share_table, share_hash, share_less, NULL);
+  
+  frames = malloc (sizeof *frames * ram_pages);
+  if (frames == NULL)
+    PANIC ("out of memory allocating page frames");
+
+  while ((base = palloc_get_page (PAL_USER)) != NULL) 
+    {
+      struct frame *f = &frames[frame_cnt++];
+      lock_init (&f->lock);
+      f->base = base;
+      list_init (&f->pages);
+      f->shared = false;
+    }
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void) 
+{
+  printf ("Frames: %zu frames, %lld evictions, %lld shared mappings\n",
+          frame_cnt, evict_cnt, share_cnt);
+}
+
+/* Tries to lock frame F without blocking.  Fails if another
+   thread holds it or if the current thread already does, for
+   example because it has pinned F's page during a system
+   call. */
+static bool
+try_frame_lock (struct frame *f) 
+{
+  return !lock_held_by_current_thread (&f->lock) && lock_try_acquire (&f->lock);
+}
+
+/* Removes frame F, which must be locked, from the share table,
+   if it is there. */
+static void
+unshare (struct frame *f) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->shared) 
+    {
+      lock_acquire (&share_lock);
+      hash_delete (&share_table, &f->share_elem);
+      lock_release (&share_lock);
+      f->shared = false;
+    }
+}
+
+/* Returns true if any page in frame F, which must be locked,
+   has been accessed recently, clearing all their accessed
+   bits. */
+static bool
+frame_accessed_recently (struct frame *f) 
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      if (page_accessed_recently (p))
+        accessed = true;
+    }
+  return accessed;
+}
+
+/* Evicts the pages in frame F, which must be locked, leaving
+   it free.  Returns true if successful, false on failure. */
+static bool
+evict_frame (struct frame *f) 
+{
+  while (!list_empty (&f->pages)) 
+    {
+      struct page *p = list_entry (list_front (&f->pages),
+                                   struct page, frame_elem);
+      if (!page_out (p))
+        return false;
+      list_pop_front (&f->pages);
+    }
+  unshare (f);
+  return true;
+}
+
+/* Finds a free frame and returns it, locked for PAGE, or
+   returns a null pointer if there is none.  The caller must
+   hold scan_lock. */
+static struct frame *
+find_free_frame (struct page *page) 
+{
+  size_t i;
+
+  for (i = 0; i < frame_cnt; i++)
+    {
+      struct frame *f = &frames[i];
+      if (!try_frame_lock (f))
+        continue;
+      if (list_empty (&f->pages)) 
+        {
+          list_push_back (&f->pages, &page->frame_elem);
+          return f;
+        } 
+      lock_release (&f->lock);
+    }
+  return NULL;
+}
+
+/* Tries to allocate and lock a frame for PAGE.
+   Returns the frame if successful, a null pointer on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page) 
+{
+  struct frame *f;
+  size_t i;
+
+  lock_acquire (&scan_lock);
+
+  /* Find a free frame. */
+  f = find_free_frame (page);
+  if (f != NULL) 
+    {
+      lock_release (&scan_lock);
+      return f;
+    }
+
+  /* No free frame.  Find a frame to evict.  Two trips around
+     the clock clear every accessed bit, so the second trip
+     finds a victim unless every frame is locked. */
+  for (i = 0; i < frame_cnt * 2; i++) 
+    {
+      /* Get a frame. */
+      f = &frames[hand];
+      if (++hand >= frame_cnt)
+        hand = 0;
+
+      if (!try_frame_lock (f))
+        continue;
+
+      if (list_empty (&f->pages)) 
+        {
+          list_push_back (&f->pages, &page->frame_elem);
+          lock_release (&scan_lock);
+          return f;
+        } 
+
+      if (frame_accessed_recently (f)) 
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+          
+      lock_release (&scan_lock);
+      
+      /* Evict this frame. */
+      if (!evict_frame (f))
+        {
+          lock_release (&f->lock);
+          return NULL;
+        }
+
+      evict_cnt++;
+      list_push_back (&f->pages, &page->frame_elem);
+      return f;
+    }
+
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Tries really hard to allocate and lock a frame for PAGE.
+   Returns the frame if successful, a null pointer on failure. */
+struct frame *
+frame_alloc_and_lock (struct page *page) 
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++) 
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL) 
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f; 
+        }
+
+      /* Every frame is locked.  Give their holders a chance to
+         finish with them. */
+      timer_msleep (1000);
+    }
+
+  return NULL;
+}
+
+/* Allocates and locks a frame for PAGE if one is free, without
+   evicting any page to make room.  Returns the frame, or a null
+   pointer if none is free. */
+struct frame *
+frame_alloc_free_and_lock (struct page *page) 
+{
+  struct frame *f;
+
+  lock_acquire (&scan_lock);
+  f = find_free_frame (page);
+  lock_release (&scan_lock);
+  return f;
+}
+
+/* Locks P's frame into memory, if it has one.
+   Upon return, p->frame will not change until P is unlocked. */
+void
+frame_lock (struct page *p) 
+{
+  /* A frame can be asynchronously removed, but never inserted. */
+  struct frame *f = p->frame;
+  if (f != NULL) 
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL); 
+        } 
+    }
+}
+
+/* Looks in the share table for a frame holding the data at
+   OFFSET in the file whose inode is at INODE_SECTOR.  If there
+   is one, maps page P to it and returns it locked.  Otherwise,
+   returns a null pointer. */
+struct frame *
+frame_share_lock (struct page *p, disk_sector_t inode_sector, off_t offset) 
+{
+  struct frame key, *f;
+  struct hash_elem *e;
+
+  key.inode_sector = inode_sector;
+  key.offset = offset;
+  lock_acquire (&share_lock);
+  e = hash_find (&share_table, &key.share_elem);
+  lock_release (&share_lock);
+  if (e == NULL)
+    return NULL;
+
+  /* The frame may be evicted and reused before we lock it, so
+     check again that it holds the data we want. */
+  f = hash_entry (e, struct frame, share_elem);
+  if (lock_held_by_current_thread (&f->lock))
+    return NULL;
+  lock_acquire (&f->lock);
+  if (!f->shared || f->inode_sector != inode_sector || f->offset != offset)
+    {
+      lock_release (&f->lock);
+      return NULL;
+    }
+
+  list_push_back (&f->pages, &p->frame_elem);
+  share_cnt++;
+  return f;
+}
+
+/* Enters frame F, which must be locked and hold the data at
+   OFFSET in the file whose inode is at INODE_SECTOR, in the
+   share table.  If another frame with the same data got there
+   first, F simply stays private. */
+void
+frame_share (struct frame *f, disk_sector_t inode_sector, off_t offset) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (!f->shared);
+
+  f->inode_sector = inode_sector;
+  f->offset = offset;
+  lock_acquire (&share_lock);
+  f->shared = hash_insert (&share_table, &f->share_elem) == NULL;
+  lock_release (&share_lock);
+}
+
+/* Unmaps page P from its frame, which P must have locked, and
+   unlocks the frame.  Once no page is left in the frame, it is
+   free for use by another page and any data in it is lost. */
+void
+frame_free (struct page *p)
+{
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  list_remove (&p->frame_elem);
+  p->frame = NULL;
+  if (list_empty (&f->pages))
+    unshare (f);
+  lock_release (&f->lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked for use by the current process. */
+void
+frame_unlock (struct frame *f) 
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Returns a hash value for the data in shared frame F. */
+static unsigned
+share_hash (const struct hash_elem *f_, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (f_, struct frame, share_elem);
+  return hash_bytes (&f->inode_sector, sizeof f->inode_sector) ^ f->offset;
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+
+  if (a->inode_sector != b->inode_sector)
+    return a->inode_sector < b->inode_sector;
+  return a->offset < b->offset;
+}
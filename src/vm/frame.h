@@ -0,0 +1,43 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct page;
+
+/* A physical frame in the user pool. */
+struct frame 
+  {
+    struct lock lock;           /* Prevent simultaneous access. */
+    void *base;                 /* Kernel virtual base address. */
+    struct list pages;          /* Mapped process pages, if any. */
+
+    /* Read-only file data shared among processes, protected by
+       LOCK.  SHARE_ELEM is also protected by the share table's
+       lock. */
+    bool shared;                /* In share table? */
+    disk_sector_t inode_sector; /* Inode of file data. */
+    off_t offset;               /* Offset of data in file. */
+    struct hash_elem share_elem; /* Share table element. */
+  };
+
+void frame_init (void);
+void frame_print_stats (void);
+
+struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_alloc_free_and_lock (struct page *);
+void frame_lock (struct page *);
+
+struct frame *frame_share_lock (struct page *, disk_sector_t inode_sector,
+                                off_t offset);
+void frame_share (struct frame *, disk_sector_t inode_sector, off_t offset);
+
+void frame_free (struct page *);
+void frame_unlock (struct frame *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,654 @@
+#include "vm/page.h"
+#include <stdio.h>
+#include <string.h>
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+
+/* Number of pages, including the one that faulted, that a page
+   fault tries to map at once.  See page_in_around(). */
+size_t fault_around = 8;
+
+/* Maximum size of a process's stack, in pages. */
+size_t stack_max = 256;
+
+/* Largest window page_in_around() handles. */
+#define FAULT_AROUND_MAX 32
+
+/* Number of pages recorded by page_allocate(), brought into
+   memory by page_in(), and evicted by page_out(), since boot.
+   The difference of the first two is what loading pages on
+   demand saved.  Also, the number of pages that page_fork()
+   shared copy-on-write, and of those that were later copied. */
+static long long page_cnt;
+static long long page_in_cnt;
+static long long page_out_cnt;
+static long long cow_share_cnt;
+static long long cow_copy_cnt;
+
+/* Writes page P, whose frame must be locked, back to its file.
+   Returns true if successful, false on failure. */
+static bool
+write_back (struct page *p) 
+{
+  return (file_write_at (p->file, p->frame->base, p->file_bytes,
+                         p->file_offset) == p->file_bytes);
+}
+
+/* Destroys a page, which must be in the current process's
+   page table, writing it back to its file first if it is a
+   modified page of a memory-mapped file.  Used as a callback
+   for hash_destroy(). */
+static void
+destroy_page (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, hash_elem);
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      /* Unmap the frame first, so that pagedir_destroy() does
+         not free it out from under the frame table. */
+      pagedir_clear_page (p->thread->pagedir, p->addr);
+      if (!p->private && pagedir_is_dirty (p->thread->pagedir, p->addr))
+        write_back (p);
+      frame_free (p);
+    }
+  swap_release (p);
+  free (p);
+}
+
+/* Destroys the current process's page table. */
+void
+page_exit (void)
+{
+  struct hash *h = thread_current ()->pages;
+
+  if (h != NULL)
+    {
+      hash_destroy (h, destroy_page);
+      free (h);
+      thread_current ()->pages = NULL;
+    }
+}
+
+/* Prints paging statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld pages mapped, %lld paged in, %lld paged out\n",
+          page_cnt, page_in_cnt, page_out_cnt);
+  printf ("Copy-on-write: %lld pages shared, %lld copied\n",
+          cow_share_cnt, cow_copy_cnt);
+  frame_print_stats ();
+  swap_print_stats ();
+}
+
+/* Returns the page containing the given virtual ADDRESS, or a
+   null pointer if no such page exists. */
+static struct page *
+page_for_addr (const void *address)
+{
+  struct hash *h = thread_current ()->pages;
+  struct page p;
+  struct hash_elem *e;
+
+  if (h == NULL || !is_user_vaddr (address))
+    return NULL;
+  p.addr = (void *) pg_round_down (address);
+  e = hash_find (h, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Read-only file data, that is, executable text, can be shared
+   with other processes running the same program.  If P is such
+   a page, returns the sector of its file's inode, which with
+   P's file offset identifies its data in the share table.
+   Otherwise, returns -1. */
+static disk_sector_t
+share_key (const struct page *p) 
+{
+  if (!p->read_only || p->file == NULL)
+    return (disk_sector_t) -1;
+  return inode_get_inumber (file_get_inode (p->file));
+}
+
+/* Locks a frame for page P and pages it in.
+   Returns true if successful, false on failure. */
+static bool
+do_page_in (struct page *p)
+{
+  disk_sector_t inode_sector = share_key (p);
+
+  /* Use another process's copy of shared data, if there is
+     one. */
+  if (inode_sector != (disk_sector_t) -1) 
+    {
+      p->frame = frame_share_lock (p, inode_sector, p->file_offset);
+      if (p->frame != NULL)
+        return true;
+    }
+
+  /* Get a frame for the page. */
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+
+  /* Copy data into the frame. */
+  if (p->sector != (disk_sector_t) -1) 
+    swap_in (p); 
+  else if (p->file != NULL) 
+    {
+      off_t read_bytes = file_read_at (p->file, p->frame->base,
+                                       p->file_bytes, p->file_offset);
+      if (read_bytes != p->file_bytes)
+        {
+          frame_free (p);
+          return false;
+        }
+      memset ((uint8_t *) p->frame->base + read_bytes, 0,
+              PGSIZE - read_bytes);
+      if (inode_sector != (disk_sector_t) -1)
+        frame_share (p->frame, inode_sector, p->file_offset);
+    }
+  else 
+    memset (p->frame->base, 0, PGSIZE);
+
+  page_in_cnt++;
+  return true;
+}
+
+/* Returns true if P's frame, which P must have locked, is also
+   mapped by other pages.  A writable page in a shared frame is
+   shared copy-on-write, so it must be mapped read-only. */
+static bool
+is_shared (const struct page *p) 
+{
+  struct list *pages = &p->frame->pages;
+  return list_begin (pages) != list_rbegin (pages);
+}
+
+/* Gives page P, which must be locked into memory and mapped in
+   the current process, a private copy of its frame, if it
+   shares it copy-on-write, and maps the copy in its place.
+   Returns true if successful, false on failure. */
+static bool
+break_cow (struct page *p) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct frame *old = p->frame;
+  bool dirty, success;
+
+  if (p->read_only || !is_shared (p))
+    return true;
+
+  /* Move P to a frame of its own.  While we allocate it, OLD
+     stays locked, so it can't be evicted. */
+  list_remove (&p->frame_elem);
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    {
+      p->frame = old;
+      list_push_back (&old->pages, &p->frame_elem);
+      return false;
+    }
+  memcpy (p->frame->base, old->base, PGSIZE);
+
+  /* Replace the read-only mapping of OLD by a writable one of the
+     copy.  The dirty bit still tells whether P differs from its
+     file, so carry it over.  The page table entry exists, so
+     this cannot fail. */
+  dirty = pagedir_is_dirty (pd, p->addr);
+  pagedir_clear_page (pd, p->addr);
+  success = pagedir_set_page (pd, p->addr, p->frame->base, true);
+  ASSERT (success);
+  pagedir_set_dirty (pd, p->addr, dirty);
+  frame_unlock (old);
+
+  /* The copy is about to differ from any file a private page
+     came from.  A page of a memory-mapped file is written back
+     to it as usual. */
+  if (p->private)
+    p->file = NULL;
+  cow_copy_cnt++;
+  return true;
+}
+
+/* Pages in and locks page P and makes sure it is mapped into the
+   current process's page table.  If WILL_WRITE is true, also
+   gives P a private copy of a frame it shares copy-on-write and
+   maps it writable.  Returns true if successful, false on
+   failure, in which case P is left unlocked. */
+static bool
+page_in_and_lock (struct page *p, bool will_write) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  frame_lock (p);
+  if (p->frame == NULL && !do_page_in (p))
+    return false;
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Map the page, if it isn't already.  Pages start out
+     read-only, so that a page shared copy-on-write isn't
+     written. */
+  if (pagedir_get_page (pd, p->addr) == NULL
+      && !pagedir_set_page (pd, p->addr, p->frame->base, false))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+
+  if (will_write && !break_cow (p)) 
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+
+  /* Allow writes to a writable page that no other page shares. */
+  if (!p->read_only && !is_shared (p))
+    pagedir_set_writable (pd, p->addr, true);
+  return true;
+}
+
+/* Returns true if page B holds the data that follows page A's
+   in the same file, so that both can be read at once. */
+static bool
+follows (const struct page *a, const struct page *b) 
+{
+  return (b->file == a->file
+          && a->file_bytes == PGSIZE
+          && b->file_offset == a->file_offset + PGSIZE
+          && b->sector == (disk_sector_t) -1);
+}
+
+/* Maps page P, which has just been read into its locked frame,
+   and unlocks it. */
+static void
+map_new_page (struct page *p) 
+{
+  if (pagedir_set_page (thread_current ()->pagedir, p->addr,
+                        p->frame->base, !p->read_only))
+    frame_unlock (p->frame);
+  else
+    frame_free (p);
+}
+
+/* Brings the CNT pages in RUN, which hold consecutive data in
+   the same file, into free frames and maps them.  Each stretch
+   of the pages whose frames happen to be adjacent in memory is
+   read with a single file_read_at(), which reads the sectors
+   that lie contiguously on disk with a single request.  Pages
+   that don't get in are left for the page fault handler. */
+static void
+page_in_run (struct page **run, size_t cnt) 
+{
+  size_t i, j;
+
+  /* Allocate frames, but don't evict anything for pages that
+     may not be used. */
+  for (i = 0; i < cnt; i++) 
+    {
+      run[i]->frame = frame_alloc_free_and_lock (run[i]);
+      if (run[i]->frame == NULL)
+        break;
+    }
+  cnt = i;
+
+  for (i = 0; i < cnt; i = j) 
+    {
+      struct page *p = run[i];
+      uint8_t *base = p->frame->base;
+      off_t size = p->file_bytes;
+      off_t read_bytes;
+
+      /* Read a stretch of pages in adjacent frames. */
+      for (j = i + 1; j < cnt; j++) 
+        {
+          if (run[j]->frame->base != base + (j - i) * PGSIZE)
+            break;
+          size += run[j]->file_bytes;
+        }
+      read_bytes = file_read_at (p->file, base, size, p->file_offset);
+
+      /* Map the pages that were read in full.  A stretch may mix
+         read-only text with writable data that follows it in the
+         file, so whether to share is up to each page. */
+      for (; i < j; i++, base += PGSIZE, read_bytes -= PGSIZE) 
+        {
+          disk_sector_t inode_sector;
+
+          p = run[i];
+          if (read_bytes < p->file_bytes) 
+            {
+              frame_free (p);
+              continue;
+            }
+          memset (base + p->file_bytes, 0, PGSIZE - p->file_bytes);
+          inode_sector = share_key (p);
+          if (inode_sector != (disk_sector_t) -1)
+            frame_share (p->frame, inode_sector, p->file_offset);
+          page_in_cnt++;
+          map_new_page (p);
+        }
+    }
+}
+
+/* Fault-around.  Brings in and maps the pages that P, which is
+   not in memory, shares an aligned window of fault_around pages
+   with, so that a process that touches its pages in order takes
+   a fault only once per window.  Read-only data that another
+   process already has in memory is just mapped.  Pages that
+   come from adjacent data in a file are read together.  Other
+   pages, and pages already in memory, are left alone. */
+static void
+page_in_around (struct page *p) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t window = fault_around < FAULT_AROUND_MAX ? fault_around
+                                                  : FAULT_AROUND_MAX;
+  uintptr_t first = pg_no (p->addr) / window * window;
+  struct page *run[FAULT_AROUND_MAX];
+  size_t run_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < window; i++) 
+    {
+      struct page *q = page_for_addr ((void *) ((first + i) << PGBITS));
+      disk_sector_t inode_sector;
+
+      if (q == NULL || q->frame != NULL
+          || q->file == NULL || q->sector != (disk_sector_t) -1) 
+        {
+          /* Not a page we can read in. */
+          page_in_run (run, run_cnt);
+          run_cnt = 0;
+          continue;
+        }
+
+      /* Map shared data already in memory. */
+      inode_sector = share_key (q);
+      if (inode_sector != (disk_sector_t) -1) 
+        {
+          q->frame = frame_share_lock (q, inode_sector, q->file_offset);
+          if (q->frame != NULL) 
+            {
+              if (pagedir_set_page (pd, q->addr, q->frame->base, false))
+                frame_unlock (q->frame);
+              else
+                frame_free (q);
+              page_in_run (run, run_cnt);
+              run_cnt = 0;
+              continue;
+            }
+        }
+
+      /* Add Q to the run of pages to read. */
+      if (run_cnt > 0 && !follows (run[run_cnt - 1], q)) 
+        {
+          page_in_run (run, run_cnt);
+          run_cnt = 0;
+        }
+      run[run_cnt++] = q;
+    }
+  page_in_run (run, run_cnt);
+}
+
+/* Handles a fault on the page containing FAULT_ADDR, which was
+   either not present or, if WRITE is true, possibly a write to a
+   page shared copy-on-write.  Returns true if successful, false
+   if the current process has no page there, if WRITE is true
+   and the page is read-only, or if bringing the page in or
+   copying it fails. */
+bool
+page_in (void *fault_addr, bool write)
+{
+  struct page *p = page_for_addr (fault_addr);
+
+  if (p == NULL || (write && p->read_only))
+    return false;
+  if (p->frame == NULL && fault_around > 1)
+    page_in_around (p);
+  if (!page_in_and_lock (p, write))
+    return false;
+  frame_unlock (p->frame);
+  return true;
+}
+
+/* Grows the current process's stack to cover FAULT_ADDR, where
+   the process took a not-present fault with its stack pointer
+   at ESP, if FAULT_ADDR looks like a stack access.  It does if
+   it is no more than 32 bytes below ESP, which PUSHA may touch
+   before it moves ESP, and if it is within stack_max pages of
+   the top of user memory.  Only the page that was touched is
+   added.  Returns true if successful, false otherwise. */
+bool
+page_grow_stack (void *fault_addr, const void *esp) 
+{
+  if (thread_current ()->pages == NULL
+      || !is_user_vaddr (fault_addr)
+      || pg_no (PHYS_BASE) - pg_no (fault_addr) > stack_max
+      || (uintptr_t) fault_addr + 32 < (uintptr_t) esp)
+    return false;
+  return (page_allocate (fault_addr, false) != NULL
+          && page_in (fault_addr, false));
+}
+
+/* Evicts page P, whose frame must be locked by the current
+   thread.  Returns true if successful, false on failure. */
+bool
+page_out (struct page *p) 
+{
+  bool dirty;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  /* Mark page not present in page table, forcing accesses by the
+     process to fault.  This must happen before checking the
+     dirty bit, to prevent a race with the process dirtying the
+     page. */
+  pagedir_clear_page (p->thread->pagedir, p->addr);
+
+  /* A clean page that came from a file can be read from the
+     file again.  A modified page of a memory-mapped file is
+     written back to it.  Anything else goes to swap. */
+  dirty = pagedir_is_dirty (p->thread->pagedir, p->addr);
+  if (p->file == NULL || (dirty && p->private)) 
+    {
+      if (!swap_out (p))
+        return false;
+      p->file = NULL;
+    }
+  else if (dirty && !write_back (p))
+    return false;
+
+  p->frame = NULL;
+  page_out_cnt++;
+  return true;
+}
+
+/* Returns true if page P's data has been accessed recently,
+   false otherwise.  Clears P's accessed bit, so that P is
+   evicted the next time around if it is not used again.
+   P must have a frame locked into memory. */
+bool
+page_accessed_recently (struct page *p) 
+{
+  bool was_accessed;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  was_accessed = pagedir_is_accessed (p->thread->pagedir, p->addr);
+  if (was_accessed)
+    pagedir_set_accessed (p->thread->pagedir, p->addr, false);
+  return was_accessed;
+}
+
+/* Adds a mapping for user virtual address VADDR to the current
+   process's page table, to be filled with zeros on first touch
+   unless the caller sets the returned page's file members.
+   If READ_ONLY is true, the page will be read-only.  The page
+   is private unless the caller changes that.
+   Returns the new page if successful, or a null pointer if
+   VADDR is not a user address, if it is already mapped, or if
+   memory allocation fails. */
+struct page *
+page_allocate (void *vaddr, bool read_only)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  if (!is_user_vaddr (vaddr))
+    return NULL;
+
+  p = malloc (sizeof *p);
+  if (p != NULL)
+    {
+      p->addr = pg_round_down (vaddr);
+      p->read_only = read_only;
+      p->thread = t;
+      p->frame = NULL;
+      p->sector = (disk_sector_t) -1;
+      p->private = true;
+      p->file = NULL;
+      p->file_offset = 0;
+      p->file_bytes = 0;
+
+      if (hash_insert (t->pages, &p->hash_elem) != NULL)
+        {
+          /* Already mapped. */
+          free (p);
+          p = NULL;
+        }
+      else
+        page_cnt++;
+    }
+  return p;
+}
+
+/* Removes the page containing VADDR from the current process's
+   page table, writing it back to its file first if it is a
+   modified page of a memory-mapped file. */
+void
+page_deallocate (void *vaddr) 
+{
+  struct page *p = page_for_addr (vaddr);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  destroy_page (&p->hash_elem, NULL);
+}
+
+/* Makes sure the page containing ADDR is in memory and locks
+   it there, so that the kernel can access it through its
+   kernel address until page_unlock() is called.  If WILL_WRITE
+   is true, the page must be writable.  Returns true if
+   successful, false on failure. */
+bool
+page_lock (const void *addr, bool will_write) 
+{
+  struct page *p = page_for_addr (addr);
+
+  return (p != NULL
+          && (!p->read_only || !will_write)
+          && page_in_and_lock (p, will_write));
+}
+
+/* Unlocks a page locked with page_lock(). */
+void
+page_unlock (const void *addr) 
+{
+  struct page *p = page_for_addr (addr);
+  ASSERT (p != NULL);
+  frame_unlock (p->frame);
+}
+
+/* Gives the current process, which must have an empty
+   supplemental page table, a copy of PARENT's address space.
+   Pages in memory are not copied: the new process maps the
+   same frames read-only, and write faults in either process
+   copy them later (see break_cow()).  Pages of memory-mapped
+   files are not copied, because each process would then write
+   its own version back to the same part of the file.  PARENT
+   must not run meanwhile.  Returns true if successful, false on
+   failure. */
+bool
+page_fork (struct thread *parent) 
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i)) 
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *cp;
+
+      if (!pp->private)
+        continue;
+      cp = page_allocate (pp->addr, pp->read_only);
+      if (cp == NULL)
+        return false;
+
+      frame_lock (pp);
+
+      /* Share a page in swap by bringing it back into memory.
+         The parent maps it again on its next access. */
+      if (pp->frame == NULL && pp->sector != (disk_sector_t) -1
+          && !do_page_in (pp))
+        return false;
+
+      /* A private page in memory that was written is no longer
+         the same as its file, if it came from one. */
+      if (pp->frame != NULL && pp->private
+          && pagedir_is_dirty (parent->pagedir, pp->addr))
+        pp->file = NULL;
+      cp->file = pp->file;
+      cp->file_offset = pp->file_offset;
+      cp->file_bytes = pp->file_bytes;
+
+      if (pp->frame != NULL) 
+        {
+          /* Map the parent's frame read-only in both processes. */
+          struct frame *f = pp->frame;
+          cp->frame = f;
+          list_push_back (&f->pages, &cp->frame_elem);
+          pagedir_set_writable (parent->pagedir, pp->addr, false);
+          if (!pagedir_set_page (pd, cp->addr, f->base, false)) 
+            {
+              frame_free (cp);
+              return false;
+            }
+          if (!pp->read_only)
+            cow_share_cnt++;
+          frame_unlock (f);
+        }
+    }
+  return true;
+}
+
+/* Returns a hash value for the page that E refers to. */
+unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return ((uintptr_t) p->addr) >> PGBITS;
+}
+
+/* Returns true if page A precedes page B. */
+bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->addr < b->addr;
+}
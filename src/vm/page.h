@@ -0,0 +1,74 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
+
+struct thread;
+
+/* A page of a user process's virtual memory, as recorded in the
+   process's supplemental page table.  The page table proper
+   maps only the pages that are in memory; this records every
+   page the process may touch and where its contents are, so
+   that page faults can bring pages in on demand and eviction
+   can push them out again. */
+struct page 
+  {
+    /* Immutable members. */
+    void *addr;                 /* User virtual address. */
+    bool read_only;             /* Read-only page? */
+    struct thread *thread;      /* Owning thread. */
+
+    /* Accessed only in owning process context. */
+    struct hash_elem hash_elem; /* struct thread `pages' hash element. */
+
+    /* Set only in owning process context with frame->lock held.
+       Cleared only with frame->lock held. */
+    struct frame *frame;        /* Page frame. */
+    struct list_elem frame_elem; /* struct frame `pages' list element. */
+
+    /* Swap information, protected by frame->lock. */
+    disk_sector_t sector;       /* Starting sector of swap area, or -1. */
+    
+    /* Where the page's contents come from, protected by
+       frame->lock.  The first FILE_BYTES bytes are read from FILE
+       at FILE_OFFSET and the rest are zeroed.  If FILE is null,
+       the page starts out all zeros.  A private page, such as
+       one of an executable's data, never changes its file: once
+       modified, it goes to swap, and it is anonymous from then
+       on.  A page of a memory-mapped file is not private, and
+       it is written back to FILE instead. */
+    bool private;               /* False to write back to file,
+                                   true to write back to swap. */
+    struct file *file;          /* File. */
+    off_t file_offset;          /* Offset in file. */
+    off_t file_bytes;           /* Bytes to read, 1...PGSIZE. */
+  };
+
+/* Pages to bring in per page fault. */
+extern size_t fault_around;
+
+/* Maximum size of a process's stack, in pages. */
+extern size_t stack_max;
+
+void page_exit (void);
+void page_print_stats (void);
+
+struct page *page_allocate (void *, bool read_only);
+void page_deallocate (void *vaddr);
+bool page_in (void *fault_addr, bool write);
+bool page_grow_stack (void *fault_addr, const void *esp);
+bool page_out (struct page *);
+bool page_accessed_recently (struct page *);
+bool page_fork (struct thread *parent);
+
+bool page_lock (const void *, bool will_write);
+void page_unlock (const void *);
+
+hash_hash_func page_hash;
+hash_less_func page_less;
+
+#endif /* vm/page.h */
@@ -0,0 +1,99 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The swap disk, hd1:1, divided into page-size slots. */
+static struct disk *swap_disk;
+
+/* Used swap slots, one bit per slot. */
+static struct bitmap *swap_bitmap;
+
+/* Protects swap_bitmap. */
+static struct lock swap_lock;
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Number of pages written to and read from swap since boot. */
+static long long swap_out_cnt;
+static long long swap_in_cnt;
+
+/* Sets up swap. */
+void
+swap_init (void) 
+{
+  swap_disk = disk_get (1, 1);
+  if (swap_disk == NULL) 
+    {
+      printf ("no swap device--swap disabled\n");
+      swap_bitmap = bitmap_create (0);
+    }
+  else
+    swap_bitmap = bitmap_create (disk_size (swap_disk) / PAGE_SECTORS);
+  if (swap_bitmap == NULL)
+    PANIC ("couldn't create swap bitmap");
+  lock_init (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  printf ("Swap: %zu slots, %lld pages out, %lld pages in\n",
+          bitmap_size (swap_bitmap), swap_out_cnt, swap_in_cnt);
+}
+
+/* Swaps in page P, which must have a locked frame
+   (and be swapped out).  Frees P's swap slot. */
+void
+swap_in (struct page *p) 
+{
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (disk_sector_t) -1);
+
+  disk_read_multiple (swap_disk, p->sector, PAGE_SECTORS, p->frame->base);
+  swap_release (p);
+  swap_in_cnt++;
+}
+
+/* Swaps out page P, which must have a locked frame.
+   Returns true if successful, false if swap is full. */
+bool
+swap_out (struct page *p) 
+{
+  size_t slot;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_bitmap, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR) 
+    return false; 
+
+  p->sector = slot * PAGE_SECTORS;
+  disk_write_multiple (swap_disk, p->sector, PAGE_SECTORS, p->frame->base);
+  swap_out_cnt++;
+  return true;
+}
+
+/* Frees the swap slot holding page P, if any. */
+void
+swap_release (struct page *p) 
+{
+  if (p->sector != (disk_sector_t) -1) 
+    {
+      lock_acquire (&swap_lock);
+      bitmap_reset (swap_bitmap, p->sector / PAGE_SECTORS);
+      lock_release (&swap_lock);
+      p->sector = (disk_sector_t) -1;
+    }
+}